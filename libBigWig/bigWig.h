@@ -34,7 +34,7 @@ extern "C" {
  *
  * \section Testing file types
  *
- * As of version 0.3.0, libBigWig supports reading bigBed files. If an application needs to support both bigBed and bigWig input, then the `bwIsBigWig` and `bbIsBigBed` functions can be used to determine the file type. These both use the "magic" number at the beginning of the file to determine the file type.
+ * As of version 0.3.0, libBigWig supports reading bigBed files. If an application needs to support both bigBed and bigWig input, then the `bwIsBigWig` and `bbIsBigBed` functions can be used to determine the file type. These both use the "magic" number at the beginning of the file to determine the file type. Alternatively, `bwOpenAny` opens either type of file directly.
  *
  * \section Interval and entry iterators
  *
@@ -153,7 +153,6 @@ typedef struct {
     double sumSquared; /**<The sum of the squared values in the file.*/
 } bigWigHdr_t;
 
-//Should probably replace this with a hash
 /*!
  * @brief Holds the chromosomes and their lengths
  */
@@ -161,6 +160,11 @@ typedef struct {
     int64_t nKeys; /**<The number of chromosomes */
     char **chrom; /**<A list of null terminated chromosomes */
     uint32_t *len; /**<The lengths of each chromosome */
+    uint64_t hashSize; /**<The number of slots in hash, a power of 2 (or 0 if there is no hash) */
+    uint32_t *hash; /**<An open addressing hash table of chromosome names, holding each ID plus 1 (0 denotes an empty slot). Used by `bwGetTid`. */
+    uint64_t treeOffset; /**<If not 0, the list is lazily loaded (see `bwSetLazyChromThreshold`) and this is the offset of the root of the on-disk chromosome tree. Only the entries of chrom and len found by `bwGetTid` are filled in until `bwLoadChroms` is called. */
+    uint32_t keySize; /**<The size of the keys in the on-disk chromosome tree (only used if the list is lazily loaded) */
+    uint32_t lastTid; /**<The ID most recently found in the on-disk chromosome tree */
 } chromList_t;
 
 //TODO remove from bigWig.h
@@ -185,6 +189,7 @@ struct bwZoomBuffer_t { //each individual entry takes 32 bytes
 typedef struct {
     uint64_t nBlocks; /**<The number of blocks written*/
     uint32_t blockSize; /**<The maximum number of children*/
+    uint32_t chromBlockSize; /**<The maximum number of children of each node of the chromosome tree (at most 65535). This is set to 256 by `bwCreateHdr()` and may be changed before `bwWriteHdr()`.*/
     uint64_t nEntries; /**<The number of entries processed. This is used for the first contig and determining how the zoom levels are computed*/
     uint64_t runningWidthSum; /**<The running sum of the entry widths for the first contig (again, used for the first contig and computing zoom levels)*/
     uint32_t tid; /**<The current TID that's being processed*/
@@ -215,6 +220,7 @@ typedef struct {
     bwWriteBuffer_t *writeBuffer; /**<The buffer used for writing.*/
     int isWrite; /**<0: Opened for reading, 1: Opened for writing.*/
     int type; /**<0: bigWig, 1: bigBed.*/
+    struct bwBlockCache_t *blockCache; /**<Recently decompressed data blocks, or NULL (see `bwSetBlockCacheSize`).*/
 } bigWigFile_t;
 
 /*!
@@ -272,6 +278,60 @@ int bwInit(size_t bufSize);
  */
 void bwCleanup(void);
 
+/*!
+ * @brief Set the maximum number of connections used at once to fetch data blocks from a remote file.
+ * Queries overlapping many data blocks that aren't adjacent on disk would otherwise fetch them one after another, waiting a full round trip for each. The default is 8, while 1 disables concurrent fetching. This has no effect on local files.
+ * @param n The number of connections.
+ */
+void bwSetRemoteParallelism(int n);
+
+/*!
+ * @brief Set how much of each remote file is held in memory.
+ * Remote files are fetched in pages (the size of which is set by `bwInit`), which are cached so that repeatedly accessed parts of a file, such as its index, aren't downloaded again. The least recently used pages are discarded once a file's cache holds this many bytes. The default is 8MiB. This affects only files opened afterwards.
+ * @param size The number of bytes. At least two pages are always cached.
+ */
+void bwSetRemoteCacheSize(size_t size);
+
+/*!
+ * @brief Set a directory in which to keep a persistent cache of remote files.
+ * Pages fetched from remote files are then also written to this directory and read from there rather than downloaded again, including by later sessions. A cached file is discarded when the server reports a different ETag, Last-Modified time or size for it. Several processes may share the directory, since access to it is coordinated with file locks, though these may not work on network file systems. The directory is created if needed. This affects only files opened afterwards and the cache is disabled by default. The directory name is copied and released by `bwCleanup`.
+ * @param dir The directory, or NULL to disable the cache.
+ * @return 0 on success and 1 on error.
+ */
+int bwSetCacheDir(const char *dir);
+
+/*!
+ * @brief Set the number of threads used to decode the data blocks of large queries.
+ * Queries overlapping many data blocks, such as `bwGetValues` or `bwGetOverlappingIntervals` over a whole chromosome, are split into chunks of blocks that are read, decompressed and decoded concurrently. The results are identical to using a single thread. The worker threads are shared by every file and kept until this is called again or `bwCleanup` is called, so this shouldn't be called while queries are running. The default is 1, which disables this. Files opened with `bwOpenWithBackend` are always decoded by a single thread, since their read function needn't be thread-safe.
+ * @param n The number of threads, including the one running each query.
+ * @return 0 on success and 1 if not every thread could be started, in which case those that were started are used.
+ */
+int bwSetThreads(int n);
+
+/*!
+ * @brief Set how many bytes of decompressed data blocks are kept for each file.
+ * Queries that overlap the same blocks, such as sliding windows or neighbouring tiles, then don't need to read and decompress them again. The least recently used blocks are discarded once a file's cache holds this many bytes. The default is 4MiB, while 0 disables the cache. This affects only files opened afterwards.
+ * @param size The number of bytes.
+ * @see bwGetBlockCacheStats
+ */
+void bwSetBlockCacheSize(size_t size);
+
+/*!
+ * @brief Report how effective a file's cache of decompressed data blocks has been.
+ * @param fp A valid bigWigFile_t pointer.
+ * @param hits Set to the number of blocks found in the cache.
+ * @param misses Set to the number of blocks that had to be read and decompressed. Both counts are 0 if the file has no cache.
+ * @see bwSetBlockCacheSize
+ */
+void bwGetBlockCacheStats(bigWigFile_t *fp, uint64_t *hits, uint64_t *misses);
+
+/*!
+ * @brief Set the number of chromosomes above which they're read only as needed.
+ * Normally, every chromosome name and length is read when a file is opened. Files with more than this many chromosomes instead keep their chromosome list on disk, and `bwGetTid` searches it for each name not already found. This makes opening files with millions of contigs fast, but then `fp->cl->chrom` and `fp->cl->len` hold only the chromosomes that have been looked up, until `bwLoadChroms` is called. The default is 0, which disables this. This affects only files opened afterwards.
+ * @param n The number of chromosomes, or 0 to always read them all.
+ */
+void bwSetLazyChromThreshold(uint64_t n);
+
 /*!
  * @brief Determine if a file is a bigWig file.
  * This function will quickly check either local or remote files to determine if they appear to be valid bigWig files. This can be determined by reading the first 4 bytes of the file.
@@ -309,6 +369,33 @@ bigWigFile_t *bwOpen(const char *fname, CURLcode (*callBack)(CURL*), const char*
  */
 bigWigFile_t *bbOpen(const char *fname, CURLcode (*callBack)(CURL*));
 
+/*!
+ * @brief Opens a local or remote bigWig or bigBed file for reading.
+ * This is equivalent to checking the file type with `bwIsBigWig` and then calling either `bwOpen` or `bbOpen`, but the file is only opened once. For remote files, this saves a connection and a request.
+ * @param fname The file name or URL (http, https, and ftp are supported)
+ * @param callBack An optional user-supplied function. This is applied to remote connections so users can specify things like proxy and password information. See `test/testRemote` for an example.
+ * @return A bigWigFile_t * on success and NULL on error (including if the file is neither bigWig nor bigBed). The `type` member is 0 for bigWig and 1 for bigBed files.
+ */
+bigWigFile_t *bwOpenAny(const char *fname, CURLcode (*callBack)(CURL*));
+
+/*!
+ * @brief Opens a bigWig or bigBed file held in memory for reading.
+ * The file is accessed in place rather than copied, so there's no need to write it to disk first.
+ * @param buf The file contents. This must remain valid and unchanged until the file is closed, which doesn't free it.
+ * @param len The size of buf in bytes.
+ * @return A bigWigFile_t * on success and NULL on error. The `type` member is 0 for bigWig and 1 for bigBed files.
+ */
+bigWigFile_t *bwOpenFromMemory(const void *buf, size_t len);
+
+/*!
+ * @brief Opens a bigWig or bigBed file for reading with caller-supplied I/O functions.
+ * This can be used to read files from any source, such as an object store.
+ * @param backend The functions used to read the file, see `bwBackend_t`. This must remain valid until the file is closed.
+ * @param data An arbitrary pointer passed to each of the functions in backend.
+ * @return A bigWigFile_t * on success and NULL on error. backend->close() is called when the file is closed, or immediately if this fails. The `type` member is 0 for bigWig and 1 for bigBed files.
+ */
+bigWigFile_t *bwOpenWithBackend(const bwBackend_t *backend, void *data);
+
 /*!
  * @brief Returns a string containing the SQL entry (or NULL).
  * The "auto SQL" field contains the names and value types of the entries in
@@ -341,6 +428,23 @@ void bwClose(bigWigFile_t *fp);
  */
 uint32_t bwGetTid(const bigWigFile_t *fp, const char *chrom);
 
+/*!
+ * @brief Read every chromosome name and length of a lazily loaded chromosome list
+ * Afterward, every entry of `fp->cl->chrom` and `fp->cl->len` is filled in. This does nothing if the list was already read in full. Looking up a name that isn't in the file also does this, since the on-disk chromosome tree isn't necessarily sorted.
+ * @param fp A valid bigWigFile_t pointer
+ * @return 0 on success and 1 on error
+ * @see bwSetLazyChromThreshold
+ */
+int bwLoadChroms(bigWigFile_t *fp);
+
+/*!
+ * @brief Load the whole index of the full-resolution data into flat arrays.
+ * By default, the index is an R-tree whose nodes are read as queries need them. After calling this, the entire index is held in memory as sorted arrays and each query finds its first overlapping data block with a binary search instead of walking the tree. This is worthwhile when a file will receive many queries. It's safe to call this while other threads are querying the file.
+ * @param fp A valid bigWigFile_t pointer, opened for reading.
+ * @return 0 on success, 1 on error.
+ */
+int bwFlattenIndex(bigWigFile_t *fp);
+
 /*!
  * @brief Frees space allocated by `bwGetOverlappingIntervals`
  * @param o A valid `bwOverlappingIntervals_t` pointer.
@@ -369,6 +473,18 @@ void bbDestroyOverlappingEntries(bbOverlappingEntries_t *o);
  */
 bwOverlappingIntervals_t *bwGetOverlappingIntervals(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end);
 
+/*!
+ * @brief Like `bwGetOverlappingIntervals`, but with a chromosome ID rather than a name.
+ * This avoids looking up the chromosome name when many queries are made.
+ * @param fp A valid bigWigFile_t pointer. This MUST be for a bigWig file!
+ * @param tid A chromosome ID, as returned by `bwGetTid`.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @return NULL on error or no overlapping values, otherwise a `bwOverlappingIntervals_t *` holding the values and intervals.
+ * @see bwGetOverlappingIntervals
+ */
+bwOverlappingIntervals_t *bwGetOverlappingIntervalsTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end);
+
 /*!
  * @brief Return bigBed entries overlapping an interval.
  * Find all bigBed entries overlapping a range and returns them.
@@ -383,6 +499,18 @@ bwOverlappingIntervals_t *bwGetOverlappingIntervals(bigWigFile_t *fp, const char
  */
 bbOverlappingEntries_t *bbGetOverlappingEntries(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, int withString);
 
+/*!
+ * @brief Like `bbGetOverlappingEntries`, but with a chromosome ID rather than a name.
+ * @param fp A valid bigWigFile_t pointer. This MUST be for a bigBed file!
+ * @param tid A chromosome ID, as returned by `bwGetTid`.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @param withString If not 0, return the string associated with each entry in the output. If 0, there are no associated strings returned. This is useful if the only information needed are the locations of the entries, which require significantly less memory.
+ * @return NULL on error or no overlapping values, otherwise a `bbOverlappingEntries_t *` holding the intervals and (optionally) the associated string.
+ * @see bbGetOverlappingEntries
+ */
+bbOverlappingEntries_t *bbGetOverlappingEntriesTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, int withString);
+
 /*!
  * @brief Creates an iterator over intervals in a bigWig file
  * Iterators can be traversed with `bwIteratorNext()` and destroyed with `bwIteratorDestroy()`.
@@ -447,6 +575,67 @@ void bwIteratorDestroy(bwOverlapIterator_t *iter);
  */
 bwOverlappingIntervals_t *bwGetValues(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, int includeNA);
 
+/*!
+ * @brief Like `bwGetValues`, but with a chromosome ID rather than a name.
+ * @param fp A valid bigWigFile_t pointer with an open bigWig file.
+ * @param tid A chromosome ID, as returned by `bwGetTid`.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @param includeNA If not 0, report NaN as the value for positions without entries. Otherwise, only positions with values are returned.
+ * @return NULL on error, otherwise a bwOverlappingIntervals_t pointer.
+ * @see bwGetValues
+ */
+bwOverlappingIntervals_t *bwGetValuesTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, int includeNA);
+
+/*!
+ * @brief Write the value of every position in an interval to a caller-supplied array.
+ * This gives the same values as `bwGetValues` with `includeNA` set, but each data block is decoded straight into `out`, so no intervals or output are allocated.
+ * @param fp A valid bigWigFile_t pointer with an open bigWig file.
+ * @param chrom A valid chromosome name.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @param out An array of at least `end - start` values. Positions without entries are set to NaN. The contents are undefined on error.
+ * @return 0 on success and 1 on error.
+ * @see bwGetValues
+ */
+int bwGetValuesInto(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, float *out);
+
+/*!
+ * @brief Like `bwGetValuesInto`, but with a chromosome ID rather than a name.
+ * @param fp A valid bigWigFile_t pointer with an open bigWig file.
+ * @param tid A chromosome ID, as returned by `bwGetTid`.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @param out An array of at least `end - start` values.
+ * @return 0 on success and 1 on error.
+ * @see bwGetValuesInto
+ */
+int bwGetValuesIntoTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, float *out);
+
+/*!
+ * @brief Return the runs of equal values in an interval.
+ * This is like `bwGetOverlappingIntervals`, except that the intervals are clipped to the interval and adjacent ones with the same value are merged. Since most tracks are piecewise constant, this is typically far smaller than the per-base output of `bwGetValues`.
+ * @param fp A valid bigWigFile_t pointer with an open bigWig file.
+ * @param chrom A valid chromosome name.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @return NULL on error, otherwise a `bwOverlappingIntervals_t *` holding the start, end and value of each run. Positions without values are in no run.
+ * @see bwGetValues
+ * @see bwDestroyOverlappingIntervals
+ */
+bwOverlappingIntervals_t *bwGetValueRuns(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end);
+
+/*!
+ * @brief Like `bwGetValueRuns`, but with a chromosome ID rather than a name.
+ * @param fp A valid bigWigFile_t pointer with an open bigWig file.
+ * @param tid A chromosome ID, as returned by `bwGetTid`.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @return NULL on error, otherwise a `bwOverlappingIntervals_t *`.
+ * @see bwGetValueRuns
+ */
+bwOverlappingIntervals_t *bwGetValueRunsTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end);
+
 /*!
  * @brief Determines per-interval bigWig statistics
  * Can determine mean/min/max/coverage/standard deviation of values in one or more intervals in a bigWig file. You can optionally give it an interval and ask for values from X number of sub-intervals.
@@ -463,7 +652,7 @@ double *bwStats(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t en
 
 /*!
  * @brief Determines per-interval bigWig statistics
- * Can determine mean/min/max/coverage/standard deviation of values in one or more intervals in a bigWig file. You can optionally give it an interval and ask for values from X number of sub-intervals. The difference with bwStats is that zoom levels are never used.
+ * Can determine mean/min/max/coverage/standard deviation of values in one or more intervals in a bigWig file. You can optionally give it an interval and ask for values from X number of sub-intervals. The difference with bwStats is that zoom levels are never used. The intervals overlapping the whole range are fetched once and split across the bins, so asking for many bins costs about the same as a single `bwGetOverlappingIntervals` call.
  * @param fp The file from which to extract statistics.
  * @param chrom A valid chromosome name.
  * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
@@ -475,6 +664,20 @@ double *bwStats(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t en
 */
 double *bwStatsFromFull(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type);
 
+/*!
+ * @brief Determines bigWig statistics in bins of a fixed size
+ * Like `bwStatsFromFull`, this computes exact statistics from the values rather than the zoom levels. However, the bins are a fixed number of bases wide, which makes it convenient for binning entire chromosomes into small bins.
+ * @param fp The file from which to extract statistics.
+ * @param chrom A valid chromosome name.
+ * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
+ * @param end The end position of the interval.
+ * @param binSize The number of bases in each bin. The last bin is shorter if `end - start` isn't a multiple of this.
+ * @param type The type of statistic.
+ * @see bwStatsType
+ * @return NULL on error, otherwise an array of `ceil((end - start) / binSize)` values that must be free()d. Bins with no values are NaN.
+ */
+double *bwGetBinnedValues(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t binSize, enum bwStatsType type);
+
 //Writer functions
 
 /*!
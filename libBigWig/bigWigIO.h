@@ -1,6 +1,8 @@
 #ifndef LIBBIGWIG_IO_H
 #define LIBBIGWIG_IO_H
 
+#include <pthread.h>
+#include <stdint.h>
 #ifndef NOCURL
 #include <curl/curl.h>
 #else
@@ -22,6 +24,21 @@ typedef void CURL;
  */
 extern size_t GLOBAL_DEFAULTBUFFERSIZE;
 
+/*!
+ * The maximum number of bytes of each remote file held in memory. The file is fetched and cached in pages of GLOBAL_DEFAULTBUFFERSIZE bytes.
+ */
+extern size_t GLOBAL_REMOTECACHESIZE;
+
+/*!
+ * The maximum number of connections used at once to fetch ranges of a remote file with urlReadRanges().
+ */
+extern int GLOBAL_REMOTEPARALLELISM;
+
+/*!
+ * The directory in which pages of remote files are additionally stored, so they needn't be downloaded again in later sessions. NULL (the default) disables this.
+ */
+extern char *GLOBAL_CACHEDIR;
+
 /*!
  * The enumerated values that indicate the connection type used to access a file.
  */
@@ -29,9 +46,33 @@ enum bigWigFile_type_enum {
     BWG_FILE = 0,
     BWG_HTTP = 1,
     BWG_HTTPS = 2,
-    BWG_FTP = 3
+    BWG_FTP = 3,
+    BWG_MMAP = 4, /**<A local file that has been memory-mapped*/
+    BWG_MEMORY = 5, /**<A file held in memory by the caller, see urlOpenMemory()*/
+    BWG_BACKEND = 6 /**<A file accessed through caller-supplied functions, see urlOpenBackend()*/
 };
 
+/*!
+ * @brief Functions through which a file is read, for files that are neither local nor at a supported URL.
+ * Each function is given the data pointer supplied along with this structure.
+ */
+typedef struct {
+    size_t (*readAt)(void *data, size_t pos, void *buf, size_t len); /**<Copy len bytes starting at position pos into buf, returning the number of bytes copied. This is less than len only at the end of the file or on error. This must be safe to call from multiple threads at once if the file will be queried from multiple threads.*/
+    size_t (*size)(void *data); /**<Return the size of the file in bytes. This may be NULL.*/
+    void (*close)(void *data); /**<Called when the file is closed, including if opening it fails. This may be NULL.*/
+} bwBackend_t;
+
+/*!
+ * @brief A cached page of a remote file.
+ */
+typedef struct urlPage_t {
+    size_t pos; /**<The position in the file of the first byte, which is a multiple of the page size.*/
+    size_t len; /**<The number of bytes held. This is less than the page size only at the end of the file.*/
+    struct urlPage_t *prev; /**<The next more recently used page, or NULL.*/
+    struct urlPage_t *next; /**<The next less recently used page, or NULL.*/
+    char *data; /**<The contents.*/
+} urlPage_t;
+
 /*!
  * @brief This structure holds the file pointers and buffers needed for raw access to local and remote files.
  */
@@ -42,35 +83,109 @@ typedef struct {
 #endif
         FILE *fp; /**<The FILE * file pointer for local files.**/
     } x; /**<A union holding curl and fp.*/
-    void *memBuf; /**<A void * pointing to memory of size bufSize.*/
+    void *memBuf; /**<For memory-mapped files, this is the mapping itself. For files in memory, this is the caller's buffer. Remote files use pages instead.*/
     size_t filePos; /**<Current position inside the file.*/
     size_t bufPos; /**<Curent position inside the buffer.*/
-    size_t bufSize; /**<The size of the buffer.*/
-    size_t bufLen; /**<The actual size of the buffer used.*/
+    size_t bufSize; /**<The size of the buffer. For remote files, this is the size of each cached page.*/
+    size_t bufLen; /**<The actual size of the buffer used. For BWG_BACKEND, the size of the file if known, otherwise 0.*/
     enum bigWigFile_type_enum type; /**<The connection type*/
     int isCompressed; /**<1 if the file is compressed, otherwise 0*/
     const char *fname; /**<Only needed for remote connections. The original URL/filename requested, since we need to make multiple connections.*/
+    const bwBackend_t *backend; /**<For BWG_BACKEND, the functions used to read the file.*/
+    void *backendData; /**<For BWG_BACKEND, the data pointer passed to the functions in backend.*/
+    pthread_mutex_t lock; /**<Remote connections only: serializes urlReadAt() calls, which share the page cache and connection.*/
+    urlPage_t *pages; /**<Remote connections only: the cached pages, most recently used first.*/
+    urlPage_t *lastPage; /**<Remote connections only: the least recently used page.*/
+    size_t nPages; /**<Remote connections only: the number of cached pages.*/
+    size_t maxPages; /**<Remote connections only: the maximum number of cached pages, after which the least recently used are discarded.*/
+    char *onDisk; /**<Remote connections only: if not NULL, one flag per page denoting whether it's stored in the on-disk cache. This is NULL if there's no on-disk cache.*/
+    size_t nDiskPages; /**<Remote connections only: the number of flags in onDisk.*/
+    size_t fileLen; /**<Remote connections only: the size of the remote file, or 0 if the server didn't report it.*/
+    int cacheFd; /**<Remote connections only: the on-disk cache of the file contents.*/
+    int cacheIdxFd; /**<Remote connections only: the index of the on-disk cache, holding the file's validators and onDisk.*/
+    size_t cacheFlagOffset; /**<Remote connections only: the offset of the flags within the index of the on-disk cache.*/
+    uint64_t cacheResetId; /**<Remote connections only: the ID written to the index of the on-disk cache when it was last reset. If this changes, another process has reset the cache.*/
+#ifndef NOCURL
+    CURLM *multi; /**<Remote connections only: used by urlReadRanges() to fetch ranges concurrently. This is created when first needed.*/
+    CURL **easy; /**<Remote connections only: the connections used with multi.*/
+    int nEasy; /**<The number of connections in easy.*/
+#endif
 } URL_t;
 
 /*!
  *  @brief Reads data into the given buffer.
  *
- *  This function will store bufSize data into buf for both local and remote files. For remote files an internal buffer is used to store a (typically larger) segment of the remote file.
+ *  This function will store bufSize data into buf for both local and remote files. For remote files, the data is served from a cache of (typically larger) pages of the remote file, which are fetched as needed.
  *
  *  @param URL A URL_t * pointing to a valid opened file or remote URL.
  *  @param buf The buffer in memory that you would like filled. It must be able to hold bufSize bytes!
  *  @param bufSize The number of bytes to transfer to buf.
  *
  *  @return Returns the number of bytes stored in buf, which should be bufSize on success and something else on error.
- *
- *  @warning Note that on error, URL for remote files is left in an unusable state. You can get around this by running urlSeek() to a position outside of the range held by the internal buffer.
+
  */
 size_t urlRead(URL_t *URL, void *buf, size_t bufSize);
 
+/*!
+ *  @brief Reads data at a given position into the given buffer.
+ *
+ *  This is the equivalent of `pread()`: unlike urlSeek() followed by urlRead(), the position of local files is neither used nor changed, so multiple threads may call this at once on the same URL_t. Concurrent reads of remote files are serialized internally.
+ *
+ *  @param URL A URL_t * pointing to a valid opened file or remote URL.
+ *  @param pos The position in the file to start reading from.
+ *  @param buf The buffer in memory that you would like filled. It must be able to hold bufSize bytes!
+ *  @param bufSize The number of bytes to transfer to buf.
+ *
+ *  @return Returns the number of bytes stored in buf, which should be bufSize on success and something else on error.
+ */
+size_t urlReadAt(URL_t *URL, size_t pos, void *buf, size_t bufSize);
+
+/*!
+ *  @brief Reads several ranges of a file.
+ *
+ *  For remote files, up to GLOBAL_REMOTEPARALLELISM ranges are downloaded at once, each over its own connection, so fetching n ranges costs roughly n/GLOBAL_REMOTEPARALLELISM round trips rather than n. Otherwise, this is equivalent to calling urlReadAt() on each range.
+ *
+ *  @param URL A URL_t * pointing to a valid opened file or remote URL.
+ *  @param n The number of ranges.
+ *  @param pos The position in the file of the start of each range.
+ *  @param len The length of each range.
+ *  @param buf The buffer in memory that you would like filled, with each range stored directly after the previous one. It must be able to hold the sum of len bytes!
+ *
+ *  @return 0 on success and -1 on error.
+ */
+int urlReadRanges(URL_t *URL, size_t n, const size_t *pos, const size_t *len, void *buf);
+
+/*!
+ *  @brief Adds the parts of a remote file covering several ranges to its page cache.
+ *
+ *  All of the missing pages are fetched at once, as with urlReadRanges(), so that subsequently reading the ranges with urlReadAt() doesn't require any further requests. For local files, the operating system is instead asked to start reading the ranges in the background (with madvise() or posix_fadvise()), so the reads overlap with whatever is done in the meantime.
+ *
+ *  @param URL A URL_t * pointing to a valid opened file or remote URL.
+ *  @param n The number of ranges.
+ *  @param pos The position in the file of the start of each range.
+ *  @param len The length of each range.
+ *
+ *  @return 0 on success and -1 on error.
+ */
+int urlPrefetch(URL_t *URL, size_t n, const size_t *pos, const size_t *len);
+
+/*!
+ *  @brief Returns a pointer to bufSize bytes at a given position in a memory-mapped file.
+ *
+ *  This is like urlReadAt(), except that no data is copied. Instead, a pointer into the file mapping is returned.
+ *
+ *  @param URL A URL_t * pointing to a valid opened file.
+ *  @param pos The position in the file of the first byte.
+ *  @param bufSize The number of bytes that will be accessed.
+ *
+ *  @return A pointer to the requested bytes, which must not be modified or free()d. NULL is returned if the file isn't memory-mapped or the requested range extends past its end, in which case urlReadAt() should be used instead.
+ */
+const void *urlReadPtr(URL_t *URL, size_t pos, size_t bufSize);
+
 /*!
  *  @brief Seeks to a given position in a local or remote file.
  * 
- *  For local files, this will set the file position indicator for the file pointer to the desired position. For remote files, it sets the position to start downloading data for the next urlRead(). Note that for remote files that running urlSeek() with a pos within the current buffer will simply modify the internal offset.
+ *  For local files, this will set the file position indicator for the file pointer to the desired position. For remote files, it sets the position from which the next urlRead() will copy data. Nothing is downloaded until then.
  *
  *  @param URL A URL_t * pointing to a valid opened file or remote URL.
  *  @param pos The position to seek to.
@@ -79,12 +194,32 @@ size_t urlRead(URL_t *URL, void *buf, size_t bufSize);
  */
 CURLcode urlSeek(URL_t *URL, size_t pos);
 
+#ifndef NOCURL
+/*!
+ *  @brief Set up the state shared by all remote connections.
+ *
+ *  DNS lookups and TLS sessions are then shared by all remote files, so opening many files on the same host requires only a single lookup and handshake. Each is shared only if the installed curl supports it. Open connections aren't shared, since curl doesn't support sharing them between threads, but the handles of closed files are reused by urlOpen() instead. This is called by bwInit().
+ *
+ *  @return 0 on success and 1 on error, in which case remote files simply don't share anything.
+ */
+int urlInitShare(void);
+
+/*!
+ *  @brief Release the state set up by urlInitShare() and any idle connections.
+ *
+ *  This is called by bwCleanup(), after which remote files must no longer be used.
+ */
+void urlCleanupShare(void);
+#endif
+
 /*!
  *  @brief Open a local or remote file
  *
  *  Opens a local or remote file. Currently, http, https, and ftp are the only supported protocols and the URL must then begin with "http://", "https://", or "ftp://" as appropriate.
  *
- *  For remote files, an internal buffer is used to hold file contents, to avoid downloading entire files before starting. The size of this buffer and various variable related to connection timeout are set with bwInit().
+ *  Local files opened for reading are memory-mapped if possible, falling back to stdio otherwise.
+ *
+ *  For remote files, fetched file contents are held in a cache of fixed-size pages, to avoid downloading entire files before starting and to avoid downloading the same parts repeatedly. The least recently used pages are discarded once the cache holds GLOBAL_REMOTECACHESIZE bytes. The page size is set with bwInit(). If GLOBAL_CACHEDIR is set, then pages are also stored there and reused by later sessions for as long as the server reports the same ETag, Last-Modified time and size for the file.
  *
  *  Note that you **must** run urlClose() on this when finished. However, you would typically just use bwOpen() rather than directly calling this function.
  *
@@ -96,6 +231,41 @@ CURLcode urlSeek(URL_t *URL, size_t pos);
  */
 URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char* mode);
 
+/*!
+ *  @brief Open a file held in memory.
+ *
+ *  The file is accessed in place, so buf must remain valid and unchanged until urlClose() is called, which doesn't free it.
+ *
+ *  @param buf The file contents.
+ *  @param len The size of buf.
+ *
+ *  @return A URL_t * or NULL on error.
+ */
+URL_t *urlOpenMemory(const void *buf, size_t len);
+
+/*!
+ *  @brief Open a file that's read with caller-supplied functions.
+ *
+ *  This allows reading files from any source, such as an object store client. Nothing is cached, so backend->readAt() should be reasonably fast for small reads or do its own caching.
+ *
+ *  @param backend The functions used to read the file. This must remain valid until urlClose() is called.
+ *  @param data Passed to each of the functions in backend.
+ *
+ *  @return A URL_t * or NULL on error. If this fails, then backend->close() is still called.
+ */
+URL_t *urlOpenBackend(const bwBackend_t *backend, void *data);
+
+/*!
+ *  @brief Determine whether a file is local or held in memory.
+ *
+ *  Such files are cheap to access, unlike remote files or (as far as we know) files with a caller-supplied backend.
+ *
+ *  @param URL A URL_t * pointing to a valid opened file.
+ *
+ *  @return 1 for local files and files in memory, otherwise 0.
+ */
+int urlIsLocal(const URL_t *URL);
+
 /*!
  *  @brief Close a local/remote file
  *
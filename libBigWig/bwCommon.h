@@ -26,6 +26,145 @@ int bwSetPos(bigWigFile_t *fp, size_t pos);
  */
 size_t bwRead(void *data, size_t sz, size_t nmemb, bigWigFile_t *fp);
 
+/*!
+ * @brief A local/remote version of `pread`.
+ * Reads data from a given position in either local or remote bigWig files. Unlike `bwSetPos` followed by `bwRead`, this doesn't depend on or change any file position indicator, so a single bigWigFile_t can be queried by multiple threads at once.
+ * @param fp The bigWigFile_t * from which to copy the data.
+ * @param offset The position within the file of the first byte to copy.
+ * @param buf An allocated memory block big enough to hold the data.
+ * @param len The number of bytes to copy.
+ * @return The number of bytes copied, which is `len` on success.
+ */
+size_t bwReadAt(bigWigFile_t *fp, uint64_t offset, void *buf, size_t len);
+
+/*!
+ * @brief Reads several ranges of a file at once.
+ * For remote files, the ranges are fetched concurrently (see `bwSetRemoteParallelism`), otherwise this is equivalent to calling `bwReadAt` for each.
+ * @param fp The bigWigFile_t * from which to copy the data.
+ * @param n The number of ranges.
+ * @param offset The position within the file of the first byte of each range.
+ * @param len The number of bytes in each range.
+ * @param buf An allocated memory block big enough to hold all of the ranges, which are stored one after another.
+ * @return 0 on success and -1 on error.
+ */
+int bwReadRanges(bigWigFile_t *fp, size_t n, const size_t *offset, const size_t *len, void *buf);
+
+/*!
+ * @brief Like `bwReadAt`, but without copying.
+ * For memory-mapped local files, this returns a pointer into the mapping. In all other cases NULL is returned and nothing is read, so `bwReadAt` should be used instead.
+ * @param fp The bigWigFile_t * from which to access the data.
+ * @param offset The position within the file of the first byte.
+ * @param len The number of bytes that will be accessed.
+ * @return A pointer that must not be modified or free()d, or NULL.
+ */
+const void *bwReadPtr(bigWigFile_t *fp, uint64_t offset, size_t len);
+
+/*!
+ * Data blocks separated by at most this many bytes are fetched with a single read by `bwReadBlock`.
+ */
+#define BW_BLOCK_GAP 65536
+/*!
+ * The maximum number of bytes `bwReadBlock` will fetch at once, unless a single block is larger.
+ */
+#define BW_MAX_BLOCK_RANGE 8388608
+/*!
+ * Queries overlapping fewer data blocks than this are decoded by a single thread, even if `bwSetThreads` was used.
+ */
+#define BW_PARALLEL_MIN_BLOCKS 8
+
+/*!
+ * @brief A buffer holding one or more ranges of a file, filled by `bwReadBlock`.
+ * This should be zero-initialized before first use and released with `bwFreeBlockBuffer` when finished.
+ */
+typedef struct {
+    size_t n; /**<The number of ranges held in buf.*/
+    size_t m; /**<The number of ranges that offset and len can hold.*/
+    size_t *offset; /**<The file offset of the first byte of each range.*/
+    size_t *len; /**<The length of each range. The ranges are stored back to back in buf.*/
+    size_t bufSize; /**<The allocated size of buf.*/
+    void *buf; /**<The data.*/
+} bwBlockBuffer_t;
+
+/*!
+ * @brief Frees the memory held by a `bwBlockBuffer_t`, but not the structure itself.
+ * @param b The buffer.
+ */
+void bwFreeBlockBuffer(bwBlockBuffer_t *b);
+
+/*!
+ * @brief Access the (possibly compressed) contents of a single data block.
+ * If the block isn't already held in `b`, then it is fetched along with any following blocks in `o` that lie close by on disk, so iterating over a sorted block list requires only a handful of reads. For remote files, the following few such ranges are fetched concurrently as well. Memory-mapped files are accessed directly.
+ * @param fp The bigWigFile_t * from which to read.
+ * @param o The list of blocks, sorted by offset.
+ * @param i The index of the block within `o`.
+ * @param b The buffer to read into and hold the data.
+ * @return A pointer to the `o->size[i]` bytes of the block, which remains valid until the next call using `b`, or NULL on error.
+ */
+const void *bwReadBlock(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint64_t i, bwBlockBuffer_t *b);
+
+/*!
+ * @brief Creates an empty cache of decompressed data blocks.
+ * @param size The maximum number of bytes of data to hold.
+ * @return The cache, which must be freed with `bwDestroyBlockCache`, or NULL on error.
+ */
+struct bwBlockCache_t *bwCreateBlockCache(size_t size);
+
+/*!
+ * @brief Frees a cache created by `bwCreateBlockCache`.
+ * @param cache The cache, which may be NULL.
+ */
+void bwDestroyBlockCache(struct bwBlockCache_t *cache);
+
+/*!
+ * @brief Access the decompressed contents of a single data block.
+ * Blocks are taken from the file's cache of decompressed blocks (see `bwSetBlockCacheSize`) when possible. Otherwise, they're read with `bwReadBlock`, decompressed and added to the cache.
+ * @param fp The bigWigFile_t * from which to read.
+ * @param o The list of blocks, sorted by offset.
+ * @param i The index of the block within `o`.
+ * @param b The buffer used by `bwReadBlock`.
+ * @param buf A buffer of `fp->hdr->bufSize` bytes to hold the decompressed block. This is unused if the file isn't compressed.
+ * @param len Set to the size of the decompressed block.
+ * @return A pointer to the block, which is either `buf` or valid until the next call using `b`, or NULL on error.
+ */
+const void *bwGetBlock(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint64_t i, bwBlockBuffer_t *b, void *buf, size_t *len);
+
+/*!
+ * @brief Decompress a zlib-compressed block.
+ * This uses libdeflate if compiled with `WITHLIBDEFLATE` defined, which is considerably faster, and zlib otherwise.
+ * @param dest Where to write the decompressed data.
+ * @param destLen On input, the size of `dest`. On output, the size of the decompressed data.
+ * @param src The compressed data.
+ * @param srcLen The size of the compressed data.
+ * @return 0 on success and 1 on error.
+ */
+int bwInflate(void *dest, size_t *destLen, const void *src, size_t srcLen);
+
+/*!
+ * @brief Compress a block with zlib.
+ * This always uses zlib, so output doesn't depend on how the library was compiled.
+ * @param dest Where to write the compressed data.
+ * @param destLen On input, the size of `dest`. On output, the size of the compressed data.
+ * @param src The data to compress.
+ * @param srcLen The size of `src`.
+ * @return 0 on success and 1 on error.
+ */
+int bwDeflate(void *dest, size_t *destLen, const void *src, size_t srcLen);
+
+/*!
+ * @brief The number of threads that queries may use, as set by `bwSetThreads`.
+ * @return The number of threads, including the one running the query.
+ */
+int bwGetThreads(void);
+
+/*!
+ * @brief Run a function once for each of a number of tasks, using the thread pool started by `bwSetThreads`.
+ * The calling thread runs tasks as well, so all of them are run even if the pool is empty or busy. This returns once every task has finished.
+ * @param nTasks The number of tasks.
+ * @param func The function, which is given `arg` and the index of a task, from 0 to nTasks-1. This must be safe to call from multiple threads at once.
+ * @param arg Passed to `func`.
+ */
+void bwParallelFor(uint64_t nTasks, void (*func)(void *arg, uint64_t task), void *arg);
+
 /*!
  * @brief Determine what the file position indicator say.
  * This is equivalent to `ftell` for local or remote files.
@@ -69,6 +208,23 @@ void destroyBWOverlapBlock(bwOverlapBlock_t *b);
  */
 int bwFinalize(bigWigFile_t *fp);
 
+/*!
+ * @brief Builds the hash table used by `bwGetTid` to look up chromosome names, unless there already is one.
+ * This is called whenever a full chromosome list is created or read from a file. It's safe for multiple threads to call this at once.
+ * @param cl The chromosome list, whose entries must all be filled in.
+ * @return 0 on success, 1 on error.
+ */
+int bwBuildChromHash(chromList_t *cl);
+
+/*!
+ * @brief Search the on-disk chromosome tree of a lazily loaded chromosome list.
+ * On success, the name and length are added to `fp->cl`.
+ * @param fp A valid bigWigFile_t pointer, whose chromosome list has a treeOffset.
+ * @param chrom The chromosome name.
+ * @return The chromosome ID or -1 if it wasn't found.
+ */
+uint32_t bwSearchChromTree(bigWigFile_t *fp, const char *chrom);
+
 /// @cond SKIP
 char *bwStrdup(const char *s);
 /// @endcond
@@ -0,0 +1,57 @@
+#include "bigWig.h"
+#include "bwCommon.h"
+#include <zlib.h>
+#ifdef WITHLIBDEFLATE
+#include <libdeflate.h>
+#include <pthread.h>
+#endif
+
+#ifdef WITHLIBDEFLATE
+//A libdeflate decompressor can't be shared between threads, so each thread gets its own
+static pthread_key_t decompressorKey;
+static pthread_once_t decompressorOnce = PTHREAD_ONCE_INIT;
+
+static void freeDecompressor(void *d) {
+    libdeflate_free_decompressor(d);
+}
+
+static void makeDecompressorKey(void) {
+    pthread_key_create(&decompressorKey, freeDecompressor);
+}
+
+static struct libdeflate_decompressor *getDecompressor(void) {
+    struct libdeflate_decompressor *d;
+    pthread_once(&decompressorOnce, makeDecompressorKey);
+    d = pthread_getspecific(decompressorKey);
+    if(d) return d;
+    d = libdeflate_alloc_decompressor();
+    if(!d) return NULL;
+    if(pthread_setspecific(decompressorKey, d)) {
+        libdeflate_free_decompressor(d);
+        return NULL;
+    }
+    return d;
+}
+
+int bwInflate(void *dest, size_t *destLen, const void *src, size_t srcLen) {
+    struct libdeflate_decompressor *d = getDecompressor();
+    if(!d) return 1;
+    if(libdeflate_zlib_decompress(d, src, srcLen, dest, *destLen, destLen) != LIBDEFLATE_SUCCESS) return 1;
+    return 0;
+}
+#else
+int bwInflate(void *dest, size_t *destLen, const void *src, size_t srcLen) {
+    uLongf sz = *destLen;
+    if(uncompress(dest, &sz, src, srcLen) != Z_OK) return 1;
+    *destLen = sz;
+    return 0;
+}
+#endif
+
+//Always zlib, so that the files written don't depend on how this was compiled
+int bwDeflate(void *dest, size_t *destLen, const void *src, size_t srcLen) {
+    uLongf sz = *destLen;
+    if(compress(dest, &sz, src, srcLen) != Z_OK) return 1;
+    *destLen = sz;
+    return 0;
+}
@@ -5,7 +5,10 @@
 #include <string.h>
 #include <stdio.h>
 
-static uint64_t readChromBlock(bigWigFile_t *bw, chromList_t *cl, uint32_t keySize);
+static uint64_t readChromBlock(bigWigFile_t *bw, chromList_t *cl, uint64_t offset, uint32_t keySize);
+
+static uint64_t GLOBAL_LAZYCHROMS = 0;
+static size_t GLOBAL_BLOCKCACHESIZE = 4194304;
 
 //Return the position in the file
 long bwTell(bigWigFile_t *fp) {
@@ -32,6 +35,21 @@ size_t bwRead(void *data, size_t sz, size_t nmemb, bigWigFile_t *fp) {
     return nmemb;
 }
 
+//Like pread, returns the number of bytes read (len on success)
+size_t bwReadAt(bigWigFile_t *fp, uint64_t offset, void *buf, size_t len) {
+    return urlReadAt(fp->URL, offset, buf, len);
+}
+
+//Returns 0 on success
+int bwReadRanges(bigWigFile_t *fp, size_t n, const size_t *offset, const size_t *len, void *buf) {
+    return urlReadRanges(fp->URL, n, offset, len, buf);
+}
+
+//Returns a pointer to len bytes at offset in a memory-mapped file, otherwise NULL
+const void *bwReadPtr(bigWigFile_t *fp, uint64_t offset, size_t len) {
+    return urlReadPtr(fp->URL, offset, len);
+}
+
 //Initializes curl and sets global variables
 //Returns 0 on success and 1 on error
 //This should be called only once and bwCleanup() must be called when finished.
@@ -44,13 +62,45 @@ int bwInit(size_t defaultBufSize) {
     CURLcode rv;
     rv = curl_global_init(CURL_GLOBAL_ALL);
     if(rv != CURLE_OK) return 1;
+    urlInitShare(); //On error, remote files simply don't share anything
 #endif
     return 0;
 }
 
+void bwSetRemoteParallelism(int n) {
+    GLOBAL_REMOTEPARALLELISM = (n > 1)?n:1;
+}
+
+void bwSetRemoteCacheSize(size_t size) {
+    GLOBAL_REMOTECACHESIZE = size;
+}
+
+void bwSetBlockCacheSize(size_t size) {
+    GLOBAL_BLOCKCACHESIZE = size;
+}
+
+void bwSetLazyChromThreshold(uint64_t n) {
+    GLOBAL_LAZYCHROMS = n;
+}
+
+int bwSetCacheDir(const char *dir) {
+    char *s = NULL;
+    if(dir) {
+        s = bwStrdup(dir);
+        if(!s) return 1;
+    }
+    free(GLOBAL_CACHEDIR);
+    GLOBAL_CACHEDIR = s;
+    return 0;
+}
+
 //This should be called before quiting, to release memory acquired by curl
 void bwCleanup() {
+    bwSetThreads(1);
+    free(GLOBAL_CACHEDIR);
+    GLOBAL_CACHEDIR = NULL;
 #ifndef NOCURL
+    urlCleanupShare();
     curl_global_cleanup();
 #endif
 }
@@ -58,6 +108,7 @@ void bwCleanup() {
 static bwZoomHdr_t *bwReadZoomHdrs(bigWigFile_t *bw) {
     if(bw->isWrite) return NULL;
     uint16_t i;
+    uint8_t *buf = NULL;
     bwZoomHdr_t *zhdr = malloc(sizeof(bwZoomHdr_t));
     if(!zhdr) return NULL;
     uint32_t *level = malloc(bw->hdr->nLevels * sizeof(uint64_t));
@@ -65,7 +116,6 @@ static bwZoomHdr_t *bwReadZoomHdrs(bigWigFile_t *bw) {
         free(zhdr);
         return NULL;
     }
-    uint32_t padding = 0;
     uint64_t *dataOffset = malloc(sizeof(uint64_t) * bw->hdr->nLevels);
     if(!dataOffset) {
         free(zhdr);
@@ -80,12 +130,17 @@ static bwZoomHdr_t *bwReadZoomHdrs(bigWigFile_t *bw) {
         return NULL;
     }
 
+    //Each level is 24 bytes, there are 4 bytes of padding after the level
+    buf = malloc(24 * bw->hdr->nLevels);
+    if(!buf) goto error;
+    if(bwReadAt(bw, 0x40, buf, 24 * bw->hdr->nLevels) != 24 * (size_t) bw->hdr->nLevels) goto error;
     for(i=0; i<bw->hdr->nLevels; i++) {
-        if(bwRead((void*) &(level[i]), sizeof(uint32_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &padding, sizeof(uint32_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(dataOffset[i]), sizeof(uint64_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(indexOffset[i]), sizeof(uint64_t), 1, bw) != 1) goto error;
+        memcpy(&(level[i]), buf + 24*i, sizeof(uint32_t));
+        memcpy(&(dataOffset[i]), buf + 24*i + 8, sizeof(uint64_t));
+        memcpy(&(indexOffset[i]), buf + 24*i + 16, sizeof(uint64_t));
     }
+    free(buf);
+    buf = NULL;
 
     zhdr->level = level;
     zhdr->dataOffset = dataOffset;
@@ -96,9 +151,7 @@ static bwZoomHdr_t *bwReadZoomHdrs(bigWigFile_t *bw) {
     return zhdr;
 
 error:
-    for(i=0; i<bw->hdr->nLevels; i++) {
-        if(zhdr->idx[i]) bwDestroyIndex(zhdr->idx[i]);
-    }
+    free(buf);
     free(zhdr);
     free(level);
     free(dataOffset);
@@ -121,26 +174,56 @@ static void bwHdrDestroy(bigWigHdr_t *hdr) {
     free(hdr);
 }
 
+//For remote files, fetch everything else that's needed to open a file at once, rather than piecemeal as it's parsed
+//This is the zoom headers, the summary and the chromosome tree. The start of the file is fetched when it's opened,
+//so usually all of this is already cached and there's nothing to do
+static void bwPrefetchMetadata(bigWigFile_t *bw) {
+    size_t pos[3], len[3], n = 0;
+    bigWigHdr_t *hdr = bw->hdr;
+
+    if(urlIsLocal(bw->URL)) return;
+    if(hdr->nLevels) {
+        pos[n] = 0x40;
+        len[n++] = 24 * (size_t) hdr->nLevels;
+    }
+    if(hdr->summaryOffset) {
+        pos[n] = hdr->summaryOffset;
+        len[n++] = 40;
+    }
+    //The data section directly follows the chromosome tree
+    pos[n] = hdr->ctOffset;
+    len[n] = (hdr->dataOffset > hdr->ctOffset) ? hdr->dataOffset - hdr->ctOffset : 32;
+    if(len[n] > GLOBAL_REMOTECACHESIZE) len[n] = GLOBAL_REMOTECACHESIZE;
+    n++;
+
+    //Any errors will show up when the header is parsed
+    urlPrefetch(bw->URL, n, pos, len);
+}
+
 static void bwHdrRead(bigWigFile_t *bw) {
     uint32_t magic;
+    uint8_t buf[64];
     if(bw->isWrite) return;
     bw->hdr = calloc(1, sizeof(bigWigHdr_t));
     if(!bw->hdr) return;
 
-    if(bwRead((void*) &magic, sizeof(uint32_t), 1, bw) != 1) goto error; //0x0
+    if(bwReadAt(bw, 0, buf, 64) != 64) goto error;
+    memcpy(&magic, buf, sizeof(uint32_t)); //0x0
     if(magic != BIGWIG_MAGIC && magic != BIGBED_MAGIC) goto error;
 
-    if(bwRead((void*) &(bw->hdr->version), sizeof(uint16_t), 1, bw) != 1) goto error; //0x4
-    if(bwRead((void*) &(bw->hdr->nLevels), sizeof(uint16_t), 1, bw) != 1) goto error; //0x6
-    if(bwRead((void*) &(bw->hdr->ctOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x8
-    if(bwRead((void*) &(bw->hdr->dataOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x10
-    if(bwRead((void*) &(bw->hdr->indexOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x18
-    if(bwRead((void*) &(bw->hdr->fieldCount), sizeof(uint16_t), 1, bw) != 1) goto error; //0x20
-    if(bwRead((void*) &(bw->hdr->definedFieldCount), sizeof(uint16_t), 1, bw) != 1) goto error; //0x22
-    if(bwRead((void*) &(bw->hdr->sqlOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x24
-    if(bwRead((void*) &(bw->hdr->summaryOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x2c
-    if(bwRead((void*) &(bw->hdr->bufSize), sizeof(uint32_t), 1, bw) != 1) goto error; //0x34
-    if(bwRead((void*) &(bw->hdr->extensionOffset), sizeof(uint64_t), 1, bw) != 1) goto error; //0x38
+    memcpy(&(bw->hdr->version), buf + 0x4, sizeof(uint16_t));
+    memcpy(&(bw->hdr->nLevels), buf + 0x6, sizeof(uint16_t));
+    memcpy(&(bw->hdr->ctOffset), buf + 0x8, sizeof(uint64_t));
+    memcpy(&(bw->hdr->dataOffset), buf + 0x10, sizeof(uint64_t));
+    memcpy(&(bw->hdr->indexOffset), buf + 0x18, sizeof(uint64_t));
+    memcpy(&(bw->hdr->fieldCount), buf + 0x20, sizeof(uint16_t));
+    memcpy(&(bw->hdr->definedFieldCount), buf + 0x22, sizeof(uint16_t));
+    memcpy(&(bw->hdr->sqlOffset), buf + 0x24, sizeof(uint64_t));
+    memcpy(&(bw->hdr->summaryOffset), buf + 0x2c, sizeof(uint64_t));
+    memcpy(&(bw->hdr->bufSize), buf + 0x34, sizeof(uint32_t));
+    memcpy(&(bw->hdr->extensionOffset), buf + 0x38, sizeof(uint64_t));
+
+    bwPrefetchMetadata(bw);
 
     //zoom headers
     if(bw->hdr->nLevels) {
@@ -149,12 +232,12 @@ static void bwHdrRead(bigWigFile_t *bw) {
 
     //File summary information
     if(bw->hdr->summaryOffset) {
-        if(urlSeek(bw->URL, bw->hdr->summaryOffset) != CURLE_OK) goto error;
-        if(bwRead((void*) &(bw->hdr->nBasesCovered), sizeof(uint64_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(bw->hdr->minVal), sizeof(uint64_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(bw->hdr->maxVal), sizeof(uint64_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(bw->hdr->sumData), sizeof(uint64_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(bw->hdr->sumSquared), sizeof(uint64_t), 1, bw) != 1) goto error;
+        if(bwReadAt(bw, bw->hdr->summaryOffset, buf, 40) != 40) goto error;
+        memcpy(&(bw->hdr->nBasesCovered), buf, sizeof(uint64_t));
+        memcpy(&(bw->hdr->minVal), buf + 8, sizeof(uint64_t));
+        memcpy(&(bw->hdr->maxVal), buf + 16, sizeof(uint64_t));
+        memcpy(&(bw->hdr->sumData), buf + 24, sizeof(uint64_t));
+        memcpy(&(bw->hdr->sumSquared), buf + 32, sizeof(uint64_t));
     }
 
     //In case of uncompressed remote files, let the IO functions know to request larger chunks
@@ -178,62 +261,99 @@ static void destroyChromList(chromList_t *cl) {
     }
     if(cl->chrom) free(cl->chrom);
     if(cl->len) free(cl->len);
+    free(cl->hash);
     free(cl);
 }
 
-static uint64_t readChromLeaf(bigWigFile_t *bw, chromList_t *cl, uint32_t valueSize) {
-    uint16_t nVals, i;
-    uint32_t idx;
+//Read the nVals items of a node of the chromosome tree at once, returning a buffer that must be free()d
+//Returns NULL on error
+static uint8_t *readChromItems(bigWigFile_t *bw, uint64_t offset, uint16_t nVals, size_t itemSize) {
+    size_t len = itemSize * nVals;
+    uint8_t *buf = malloc(len ? len : 1);
+    if(!buf) return NULL;
+    if(bwReadAt(bw, offset, buf, len) != len) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+//Fill in an entry of a chromosome list, unless another thread already did
+//Returns 0 on success
+static int setChrom(chromList_t *cl, uint32_t idx, const char *chrom, uint32_t len) {
+    char *s, *expected = NULL;
+    if(__atomic_load_n(&(cl->chrom[idx]), __ATOMIC_ACQUIRE)) return 0;
+
+    s = bwStrdup(chrom);
+    if(!s) return 1;
+    __atomic_store_n(&(cl->len[idx]), len, __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&(cl->chrom[idx]), &expected, s, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) free(s);
+    return 0;
+}
+
+static uint64_t readChromLeaf(bigWigFile_t *bw, chromList_t *cl, uint64_t offset, uint16_t nVals, uint32_t valueSize) {
+    uint16_t i;
+    uint32_t idx, len;
+    uint8_t *buf, *p;
     char *chrom = NULL;
 
-    if(bwRead((void*) &nVals, sizeof(uint16_t), 1, bw) != 1) return -1;
+    buf = readChromItems(bw, offset, nVals, valueSize + 8);
+    if(!buf) return -1;
     chrom = calloc(valueSize+1, sizeof(char));
-    if(!chrom) return -1;
-
-    for(i=0; i<nVals; i++) {
-        if(bwRead((void*) chrom, sizeof(char), valueSize, bw) != valueSize) goto error;
-        if(bwRead((void*) &idx, sizeof(uint32_t), 1, bw) != 1) goto error;
-        if(bwRead((void*) &(cl->len[idx]), sizeof(uint32_t), 1, bw) != 1) goto error;
-        cl->chrom[idx] = bwStrdup(chrom);
-        if(!(cl->chrom[idx])) goto error;
+    if(!chrom) goto error;
+
+    for(i=0, p=buf; i<nVals; i++, p+=valueSize+8) {
+        memcpy(chrom, p, valueSize);
+        memcpy(&idx, p + valueSize, sizeof(uint32_t));
+        if(idx >= cl->nKeys) goto error;
+        memcpy(&len, p + valueSize + 4, sizeof(uint32_t));
+        if(setChrom(cl, idx, chrom, len)) goto error;
     }
 
     free(chrom);
+    free(buf);
     return nVals;
 
 error:
     free(chrom);
+    free(buf);
     return -1;
 }
 
-static uint64_t readChromNonLeaf(bigWigFile_t *bw, chromList_t *cl, uint32_t keySize) {
-    uint64_t offset , rv = 0, previous;
-    uint16_t nVals, i;
+static uint64_t readChromNonLeaf(bigWigFile_t *bw, chromList_t *cl, uint64_t offset, uint16_t nVals, uint32_t keySize) {
+    uint64_t child, rv = 0, n;
+    uint16_t i;
+    uint8_t *buf, *p;
 
-    if(bwRead((void*) &nVals, sizeof(uint16_t), 1, bw) != 1) return -1;
+    buf = readChromItems(bw, offset, nVals, keySize + 8);
+    if(!buf) return -1;
 
-    previous = bwTell(bw) + keySize;
-    for(i=0; i<nVals; i++) {
-        if(bwSetPos(bw, previous)) return -1;
-        if(bwRead((void*) &offset, sizeof(uint64_t), 1, bw) != 1) return -1;
-        if(bwSetPos(bw, offset)) return -1;
-        rv += readChromBlock(bw, cl, keySize);
-        previous += 8 + keySize;
+    for(i=0, p=buf; i<nVals; i++, p+=keySize+8) {
+        memcpy(&child, p + keySize, sizeof(uint64_t));
+        n = readChromBlock(bw, cl, child, keySize);
+        if(n == (uint64_t) -1) {
+            rv = -1;
+            break;
+        }
+        rv += n;
     }
 
+    free(buf);
     return rv;
 }
 
-static uint64_t readChromBlock(bigWigFile_t *bw, chromList_t *cl, uint32_t keySize) {
-    uint8_t isLeaf, padding;
+static uint64_t readChromBlock(bigWigFile_t *bw, chromList_t *cl, uint64_t offset, uint32_t keySize) {
+    uint8_t hdr[4];
+    uint16_t nVals;
 
-    if(bwRead((void*) &isLeaf, sizeof(uint8_t), 1, bw) != 1) return -1;
-    if(bwRead((void*) &padding, sizeof(uint8_t), 1, bw) != 1) return -1;
+    //The isLeaf byte is followed by a byte of padding and then the number of items
+    if(bwReadAt(bw, offset, hdr, 4) != 4) return -1;
+    memcpy(&nVals, hdr + 2, sizeof(uint16_t));
 
-    if(isLeaf) {
-        return readChromLeaf(bw, cl, keySize);
+    if(hdr[0]) {
+        return readChromLeaf(bw, cl, offset + 4, nVals, keySize);
     } else { //I've never actually observed one of these, which is good since they're pointless
-        return readChromNonLeaf(bw, cl, keySize);
+        return readChromNonLeaf(bw, cl, offset + 4, nVals, keySize);
     }
 }
 
@@ -241,19 +361,21 @@ static chromList_t *bwReadChromList(bigWigFile_t *bw) {
     chromList_t *cl = NULL;
     uint32_t magic, keySize, valueSize, itemsPerBlock;
     uint64_t rv, itemCount;
+    uint8_t buf[32];
     if(bw->isWrite) return NULL;
-    if(bwSetPos(bw, bw->hdr->ctOffset)) return NULL;
 
     cl = calloc(1, sizeof(chromList_t));
     if(!cl) return NULL;
 
-    if(bwRead((void*) &magic, sizeof(uint32_t), 1, bw) != 1) goto error;
+    //The last 8 bytes are reserved
+    if(bwReadAt(bw, bw->hdr->ctOffset, buf, 32) != 32) goto error;
+    memcpy(&magic, buf, sizeof(uint32_t));
     if(magic != CIRTREE_MAGIC) goto error;
 
-    if(bwRead((void*) &itemsPerBlock, sizeof(uint32_t), 1, bw) != 1) goto error;
-    if(bwRead((void*) &keySize, sizeof(uint32_t), 1, bw) != 1) goto error;
-    if(bwRead((void*) &valueSize, sizeof(uint32_t), 1, bw) != 1) goto error;
-    if(bwRead((void*) &itemCount, sizeof(uint64_t), 1, bw) != 1) goto error;
+    memcpy(&itemsPerBlock, buf + 4, sizeof(uint32_t));
+    memcpy(&keySize, buf + 8, sizeof(uint32_t));
+    memcpy(&valueSize, buf + 12, sizeof(uint32_t));
+    memcpy(&itemCount, buf + 16, sizeof(uint64_t));
 
     cl->nKeys = itemCount;
     cl->chrom = calloc(itemCount, sizeof(char*));
@@ -261,13 +383,18 @@ static chromList_t *bwReadChromList(bigWigFile_t *bw) {
     if(!cl->chrom) goto error;
     if(!cl->len) goto error;
 
-    if(bwRead((void*) &magic, sizeof(uint32_t), 1, bw) != 1) goto error;
-    if(bwRead((void*) &magic, sizeof(uint32_t), 1, bw) != 1) goto error;
+    //Leave the names on disk until they're looked up
+    if(GLOBAL_LAZYCHROMS && itemCount > GLOBAL_LAZYCHROMS) {
+        cl->treeOffset = bw->hdr->ctOffset + 32;
+        cl->keySize = keySize;
+        return cl;
+    }
 
     //Read in the blocks
-    rv = readChromBlock(bw, cl, keySize);
+    rv = readChromBlock(bw, cl, bw->hdr->ctOffset + 32, keySize);
     if(rv == (uint64_t) -1) goto error;
     if(rv != itemCount) goto error;
+    if(bwBuildChromHash(cl)) goto error;
 
     return cl;
 
@@ -276,6 +403,73 @@ error:
     return NULL;
 }
 
+int bwLoadChroms(bigWigFile_t *fp) {
+    chromList_t *cl = fp->cl;
+    uint64_t rv;
+    if(!cl->treeOffset || __atomic_load_n(&(cl->hash), __ATOMIC_ACQUIRE)) return 0;
+
+    rv = readChromBlock(fp, cl, cl->treeOffset, cl->keySize);
+    if(rv != (uint64_t) cl->nKeys || bwBuildChromHash(cl)) {
+        fprintf(stderr, "[bwLoadChroms] There was an error while reading the chromosome list!\n");
+        return 1;
+    }
+    return 0;
+}
+
+//Returns -1 if the first key in a node of the chromosome tree is larger than key
+//Otherwise, returns the index of the last item with a key that's not larger
+static int32_t searchChromNode(const uint8_t *items, uint16_t nVals, uint32_t keySize, const char *key) {
+    int32_t lo = 0, hi = nVals, mid;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(memcmp(items + mid * (keySize + 8), key, keySize) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+uint32_t bwSearchChromTree(bigWigFile_t *fp, const char *chrom) {
+    chromList_t *cl = fp->cl;
+    uint64_t offset = cl->treeOffset;
+    uint32_t rv = -1, idx, len, depth;
+    uint16_t nVals;
+    uint8_t hdr[4], *buf = NULL;
+    const uint8_t *items, *p;
+    char *key = calloc(cl->keySize + 1, sizeof(char));
+    int32_t i;
+    if(!key) return -1;
+    strncpy(key, chrom, cl->keySize);
+
+    //Keys are padded with NULLs, so sorting them with memcmp() is like using strcmp()
+    for(depth=0; depth<64; depth++) {
+        if(bwReadAt(fp, offset, hdr, 4) != 4) break;
+        memcpy(&nVals, hdr + 2, sizeof(uint16_t));
+        items = bwReadPtr(fp, offset + 4, (size_t) nVals * (cl->keySize + 8));
+        if(!items) {
+            items = buf = readChromItems(fp, offset + 4, nVals, cl->keySize + 8);
+            if(!buf) break;
+        }
+
+        i = searchChromNode(items, nVals, cl->keySize, key);
+        if(i < 0) break;
+        p = items + i * (cl->keySize + 8) + cl->keySize;
+        if(hdr[0]) {
+            if(memcmp(p - cl->keySize, key, cl->keySize) != 0) break;
+            memcpy(&idx, p, sizeof(uint32_t));
+            memcpy(&len, p + 4, sizeof(uint32_t));
+            if(idx < cl->nKeys && !setChrom(cl, idx, key, len)) rv = idx;
+            break;
+        }
+        memcpy(&offset, p, sizeof(uint64_t));
+        free(buf);
+        buf = NULL;
+    }
+
+    free(buf);
+    free(key);
+    return rv;
+}
+
 //This is here mostly for convenience
 static void bwDestroyWriteBuffer(bwWriteBuffer_t *wb) {
     if(wb->p) free(wb->p);
@@ -295,6 +489,7 @@ void bwClose(bigWigFile_t *fp) {
     if(fp->hdr) bwHdrDestroy(fp->hdr);
     if(fp->cl) destroyChromList(fp->cl);
     if(fp->idx) bwDestroyIndex(fp->idx);
+    bwDestroyBlockCache(fp->blockCache);
     if(fp->writeBuffer) bwDestroyWriteBuffer(fp->writeBuffer);
     free(fp);
 }
@@ -306,7 +501,7 @@ int bwIsBigWig(const char *fname, CURLcode (*callBack) (CURL*)) {
     URL = urlOpen(fname, *callBack, NULL);
 
     if(!URL) return 0;
-    if(urlRead(URL, (void*) &magic, sizeof(uint32_t)) != sizeof(uint32_t)) magic = 0;
+    if(urlReadAt(URL, 0, (void*) &magic, sizeof(uint32_t)) != sizeof(uint32_t)) magic = 0;
     urlClose(URL);
     if(magic == BIGWIG_MAGIC) return 1;
     return 0;
@@ -319,8 +514,7 @@ char *bbGetSQL(bigWigFile_t *fp) {
     len = fp->hdr->summaryOffset - fp->hdr->sqlOffset; //This includes the NULL terminator
     o = malloc(sizeof(char) * len);
     if(!o) goto error;
-    if(bwSetPos(fp, fp->hdr->sqlOffset)) goto error;
-    if(bwRead((void*) o, len, 1, fp) != 1) goto error;
+    if(bwReadAt(fp, fp->hdr->sqlOffset, (void*) o, len) != len) goto error;
     return o;
 
 error:
@@ -336,12 +530,48 @@ int bbIsBigBed(const char *fname, CURLcode (*callBack) (CURL*)) {
     URL = urlOpen(fname, *callBack, NULL);
 
     if(!URL) return 0;
-    if(urlRead(URL, (void*) &magic, sizeof(uint32_t)) != sizeof(uint32_t)) magic = 0;
+    if(urlReadAt(URL, 0, (void*) &magic, sizeof(uint32_t)) != sizeof(uint32_t)) magic = 0;
     urlClose(URL);
     if(magic == BIGBED_MAGIC) return 1;
     return 0;
 }
 
+//Read the header, chromosome list and (for local files) index of a file opened for reading
+//Returns 0 on success
+static int bwReadMetadata(bigWigFile_t *bw) {
+    //Attempt to read in the fixed header
+    bwHdrRead(bw);
+    if(!bw->hdr) {
+        fprintf(stderr, "[bwReadMetadata] bw->hdr is NULL!\n");
+        return 1;
+    }
+
+    //Read in the chromosome list
+    bw->cl = bwReadChromList(bw);
+    if(!bw->cl) {
+        fprintf(stderr, "[bwReadMetadata] bw->cl is NULL (%s)!\n", bw->URL->fname);
+        return 1;
+    }
+
+    //Read in the index
+    //For remote files this is left to the first query, since it's typically far from the start of the file
+    if(bw->hdr->indexOffset && urlIsLocal(bw->URL)) {
+        bw->idx = bwReadIndex(bw, 0);
+        if(!bw->idx) {
+            fprintf(stderr, "[bwReadMetadata] bw->idx is NULL bw->hdr->dataOffset 0x%"PRIx64"!\n", bw->hdr->dataOffset);
+            return 1;
+        }
+    }
+
+    //Only compressed blocks are worth caching
+    if(GLOBAL_BLOCKCACHESIZE && bw->hdr->bufSize) {
+        bw->blockCache = bwCreateBlockCache(GLOBAL_BLOCKCACHESIZE);
+        if(!bw->blockCache) return 1;
+    }
+
+    return 0;
+}
+
 bigWigFile_t *bwOpen(const char *fname, CURLcode (*callBack) (CURL*), const char *mode) {
     bigWigFile_t *bwg = calloc(1, sizeof(bigWigFile_t));
     if(!bwg) {
@@ -356,28 +586,7 @@ bigWigFile_t *bwOpen(const char *fname, CURLcode (*callBack) (CURL*), const char
             goto error;
         }
 
-        //Attempt to read in the fixed header
-        bwHdrRead(bwg);
-        if(!bwg->hdr) {
-            fprintf(stderr, "[bwOpen] bwg->hdr is NULL!\n");
-            goto error;
-        }
-
-        //Read in the chromosome list
-        bwg->cl = bwReadChromList(bwg);
-        if(!bwg->cl) {
-            fprintf(stderr, "[bwOpen] bwg->cl is NULL (%s)!\n", fname);
-            goto error;
-        }
-
-        //Read in the index
-        if(bwg->hdr->indexOffset) {
-            bwg->idx = bwReadIndex(bwg, 0);
-            if(!bwg->idx) {
-                fprintf(stderr, "[bwOpen] bwg->idx is NULL bwg->hdr->dataOffset 0x%"PRIx64"!\n", bwg->hdr->dataOffset);
-                goto error;
-            }
-        }
+        if(bwReadMetadata(bwg)) goto error;
     } else {
         bwg->isWrite = 1;
         bwg->URL = urlOpen(fname, NULL, "w+");
@@ -407,17 +616,7 @@ bigWigFile_t *bbOpen(const char *fname, CURLcode (*callBack) (CURL*)) {
     bb->URL = urlOpen(fname, *callBack, NULL);
     if(!bb->URL) goto error;
 
-    //Attempt to read in the fixed header
-    bwHdrRead(bb);
-    if(!bb->hdr) goto error;
-
-    //Read in the chromosome list
-    bb->cl = bwReadChromList(bb);
-    if(!bb->cl) goto error;
-
-    //Read in the index
-    bb->idx = bwReadIndex(bb, 0);
-    if(!bb->idx) goto error;
+    if(bwReadMetadata(bb)) goto error;
 
     return bb;
 
@@ -426,6 +625,53 @@ error:
     return NULL;
 }
 
+//Set up a bigWigFile_t for reading an opened bigWig or bigBed file, whose type is determined from its magic number
+//URL is closed on error
+static bigWigFile_t *bwOpenURL(URL_t *URL) {
+    uint32_t magic = 0;
+    bigWigFile_t *fp = NULL;
+
+    if(!URL) return NULL;
+    fp = calloc(1, sizeof(bigWigFile_t));
+    if(!fp) {
+        fprintf(stderr, "[bwOpenURL] Couldn't allocate space to create the output object!\n");
+        urlClose(URL);
+        return NULL;
+    }
+    fp->URL = URL;
+
+    //For remote files, the start of the file is already cached, so this doesn't require another request
+    if(bwReadAt(fp, 0, &magic, sizeof(uint32_t)) != sizeof(uint32_t)) goto error;
+    if(magic == BIGWIG_MAGIC) {
+        fp->type = 0;
+    } else if(magic == BIGBED_MAGIC) {
+        fp->type = 1;
+    } else {
+        fprintf(stderr, "[bwOpenURL] This is neither a bigWig nor a bigBed file!\n");
+        goto error;
+    }
+
+    if(bwReadMetadata(fp)) goto error;
+
+    return fp;
+
+error:
+    bwClose(fp);
+    return NULL;
+}
+
+bigWigFile_t *bwOpenAny(const char *fname, CURLcode (*callBack) (CURL*)) {
+    return bwOpenURL(urlOpen(fname, *callBack, NULL));
+}
+
+bigWigFile_t *bwOpenFromMemory(const void *buf, size_t len) {
+    return bwOpenURL(urlOpenMemory(buf, len));
+}
+
+bigWigFile_t *bwOpenWithBackend(const bwBackend_t *backend, void *data) {
+    return bwOpenURL(urlOpenBackend(backend, data));
+}
+
 
 //Implementation taken from musl:
 //https://git.musl-libc.org/cgit/musl/tree/src/string/strdup.c
@@ -25,27 +25,6 @@ static int32_t determineZoomLevel(const bigWigFile_t *fp, int basesPerBin) {
     return out;
 }
 
-/// @cond SKIP
-struct val_t {
-    uint32_t nBases;
-    float min, max, sum, sumsq;
-    double scalar;
-};
-
-struct vals_t {
-    uint32_t n;
-    struct val_t **vals;
-};
-/// @endcond
-
-void destroyVals_t(struct vals_t *v) {
-    uint32_t i;
-    if(!v) return;
-    for(i=0; i<v->n; i++) free(v->vals[i]);
-    if(v->vals) free(v->vals);
-    free(v);
-}
-
 //Determine the base-pair overlap between an interval and a block
 double getScalar(uint32_t i_start, uint32_t i_end, uint32_t b_start, uint32_t b_end) {
     double rv = 0.0;
@@ -59,469 +38,294 @@ double getScalar(uint32_t i_start, uint32_t i_end, uint32_t b_start, uint32_t b_
     return rv;
 }
 
-//Returns NULL on error
-static struct vals_t *getVals(bigWigFile_t *fp, bwOverlapBlock_t *o, int i, uint32_t tid, uint32_t start, uint32_t end) {
-    void *buf = NULL, *compBuf = NULL;
-    uLongf sz = fp->hdr->bufSize;
-    int compressed = 0, rv;
-    uint32_t *p, vtid, vstart, vend;
-    struct vals_t *vals = NULL;
-    struct val_t *v = NULL;
-
-    if(sz) {
-        compressed = 1;
-        buf = malloc(sz);
-    }
-    sz = 0; //This is now the size of the compressed buffer
-
-    if(bwSetPos(fp, o->offset[i])) goto error;
-
-    vals = calloc(1,sizeof(struct vals_t));
-    if(!vals) goto error;
-
-    v = malloc(sizeof(struct val_t));
-    if(!v) goto error;
-
-    if(sz < o->size[i]) compBuf = malloc(o->size[i]);
-    if(!compBuf) goto error;
-
-    if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
-    if(compressed) {
-        sz = fp->hdr->bufSize;
-        rv = uncompress(buf, &sz, compBuf, o->size[i]);
-        if(rv != Z_OK) goto error;
-    } else {
-        buf = compBuf;
-        sz = o->size[i];
-    }
-
-    p = buf;
-    while(((uLongf) ((char*)p - (char*)buf)) < sz) {
-        vtid = p[0];
-        vstart = p[1];
-        vend = p[2];
-        v->nBases = p[3];
-        v->min = ((float*) p)[4];
-        v->max = ((float*) p)[5];
-        v->sum = ((float*) p)[6];
-        v->sumsq = ((float*) p)[7];
-        v->scalar = getScalar(start, end, vstart, vend);
-
-        if(tid == vtid) {
-            if((start <= vstart && end > vstart) || (start < vend && start >= vstart)) {
-                vals->vals = realloc(vals->vals, sizeof(struct val_t*)*(vals->n+1));
-                if(!vals->vals) goto error;
-                vals->vals[vals->n++] = v;
-                v = malloc(sizeof(struct val_t));
-                if(!v) goto error;
-            }
-            if(vstart > end) break;
-        } else if(vtid > tid) {
-            break;
-        }
-        p+=8;
-    }
-
-    free(v);
-    free(buf);
-    if(compressed) free(compBuf);
-    return vals;
-
-error:
-    if(buf) free(buf);
-    if(compBuf && compressed) free(compBuf);
-    if(v) free(v);
-    destroyVals_t(vals);
-    return NULL;
-}
-
-//On error, errno is set to ENOMEM and NaN is returned (though NaN can be returned normally)
-static double blockMean(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j;
-    double output = 0.0, coverage = 0.0;
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return strtod("NaN", NULL);
-
-    //Iterate over the blocks
-    for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            output += v->vals[j]->sum * v->vals[j]->scalar;
-            coverage += v->vals[j]->nBases * v->vals[j]->scalar;
-        }
-        destroyVals_t(v);
-    }
-
-
-    if(!coverage) return strtod("NaN", NULL);
-
-    return output/coverage;
+/// @cond SKIP
+//The running totals of the zoom records overlapping a bin, each scaled by how much of it lies in the bin
+struct zoomBin_t {
+    uint32_t n; //The number of records
+    double coverage, sum, sumsq;
+    double total; //What's reported for type=sum
+    double min, max;
+};
+/// @endcond
 
-error:
-    if(v) free(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
+//Add a zoom record to the bin from start to end
+static void addZoomRecord(struct zoomBin_t *b, uint32_t start, uint32_t end, const uint32_t *p) {
+    uint32_t nBases = p[3], sizeUse;
+    float min = ((const float*) p)[4], max = ((const float*) p)[5];
+    float sum = ((const float*) p)[6], sumsq = ((const float*) p)[7];
+    double scalar = getScalar(start, end, p[1], p[2]);
+
+    if(!b->n || max > b->max) b->max = max;
+    if(!b->n || min < b->min) b->min = min;
+    b->n++;
+    b->coverage += nBases * scalar;
+    b->sum += sum * scalar;
+    b->sumsq += sumsq * scalar;
+    //Multiply the block average by min(bases covered, block overlap with interval)
+    sizeUse = scalar;
+    if(sizeUse > nBases) sizeUse = nBases;
+    b->total += (sum * sizeUse) / nBases;
 }
 
-static double intMean(bwOverlappingIntervals_t* ints, uint32_t start, uint32_t end) {
-    double sum = 0.0;
-    uint32_t nBases = 0, i, start_use, end_use;
+//Add a zoom record to every bin it overlaps. Bin i runs from bounds[i] to bounds[i+1].
+static void binZoomRecord(struct zoomBin_t *bins, const uint32_t *bounds, uint32_t nBins, const uint32_t *p) {
+    uint32_t vstart = p[1], vend = p[2], lo = 0, hi = nBins, mid;
 
-    if(!ints->l) return strtod("NaN", NULL);
-
-    for(i=0; i<ints->l; i++) {
-        start_use = ints->start[i];
-        end_use = ints->end[i];
-        if(ints->start[i] < start) start_use = start;
-        if(ints->end[i] > end) end_use = end;
-        nBases += end_use-start_use;
-        sum += (end_use-start_use)*((double) ints->value[i]);
+    //Every bin before lo ends before the record starts
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(bounds[mid + 1] < vstart) lo = mid + 1;
+        else hi = mid;
     }
 
-    return sum/nBases;
-}
-
-//Does UCSC compensate for partial block/range overlap?
-static double blockDev(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j;
-    double mean = 0.0, ssq = 0.0, coverage = 0.0, diff;
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return strtod("NaN", NULL);
-
-    //Iterate over the blocks
-    for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            coverage += v->vals[j]->nBases * v->vals[j]->scalar;
-            mean += v->vals[j]->sum * v->vals[j]->scalar;
-            ssq += v->vals[j]->sumsq * v->vals[j]->scalar;
+    for(; lo < nBins && (bounds[lo] <= vstart || bounds[lo] < vend); lo++) {
+        if((bounds[lo] <= vstart && bounds[lo + 1] > vstart) || (bounds[lo] < vend && bounds[lo] >= vstart)) {
+            addZoomRecord(bins + lo, bounds[lo], bounds[lo + 1], p);
         }
-        destroyVals_t(v);
-        v = NULL;
-    }
-
-    if(coverage<=1.0) return strtod("NaN", NULL);
-    diff = ssq-mean*mean/coverage;
-    if(coverage > 1.0) diff /= coverage-1;
-    if(fabs(diff) > 1e-8) { //Ignore floating point differences
-        return sqrt(diff);
-    } else {
-        return 0.0;
     }
-
-error:
-    if(v) destroyVals_t(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
 }
 
-//This uses compensated summation to account for finite precision math
-static double intDev(bwOverlappingIntervals_t* ints, uint32_t start, uint32_t end) {
-    double v1 = 0.0, mean, rv;
-    uint32_t nBases = 0, i, start_use, end_use;
-
-    if(!ints->l) return strtod("NaN", NULL);
-    mean = intMean(ints, start, end);
-
-    for(i=0; i<ints->l; i++) {
-        start_use = ints->start[i];
-        end_use = ints->end[i];
-        if(ints->start[i] < start) start_use = start;
-        if(ints->end[i] > end) end_use = end;
-        nBases += end_use-start_use;
-        v1 += (end_use-start_use) * pow(ints->value[i]-mean, 2.0); //running sum of squared difference
+//The statistic of a bin covering len bases
+static double zoomStat(const struct zoomBin_t *b, uint32_t len, enum bwStatsType type) {
+    double diff;
+
+    switch(type) {
+    default :
+    case 0:
+        if(!b->coverage) return strtod("NaN", NULL);
+        return b->sum / b->coverage;
+    case 1:
+        //Does UCSC compensate for partial block/range overlap?
+        if(b->coverage <= 1.0) return strtod("NaN", NULL);
+        diff = b->sumsq - b->sum * b->sum / b->coverage;
+        diff /= b->coverage - 1;
+        if(fabs(diff) > 1e-8) return sqrt(diff); //Ignore floating point differences
+        return 0.0;
+    case 2:
+        if(!b->n) return strtod("NaN", NULL);
+        return b->max;
+    case 3:
+        if(!b->n) return strtod("NaN", NULL);
+        return b->min;
+    case 4:
+        if(b->coverage == 0.0) return strtod("NaN", NULL);
+        return b->coverage / len;
+    case 5:
+        if(b->total == 0.0) return strtod("NaN", NULL);
+        return b->total;
     }
-
-    if(nBases>=2) rv = sqrt(v1/(nBases-1));
-    else if(nBases==1) rv = sqrt(v1);
-    else rv = strtod("NaN", NULL);
-
-    return rv;
 }
 
-static double blockMax(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j, isNA = 1;
-    double o = strtod("NaN", NULL);
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return o;
-
-    //Iterate the blocks
-    for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            if(isNA) {
-                o = v->vals[j]->max;
-                isNA = 0;
-            } else if(v->vals[j]->max > o) {
-                o = v->vals[j]->max;
-            }
+//Returns NULL on error, otherwise a double* that needs to be free()d
+static double *bwStatsFromZoom(bigWigFile_t *fp, int32_t level, uint32_t tid, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type) {
+    bwOverlapBlock_t *blocks = NULL;
+    bwBlockBuffer_t compBuf = {0, 0, NULL, NULL, 0, NULL};
+    bwRTree_t *idx, *expected = NULL;
+    struct zoomBin_t *bins = NULL;
+    uint32_t *bounds = NULL;
+    double *output = NULL;
+    void *buf = NULL;
+    const void *block;
+    const uint32_t *p;
+    size_t sz, off;
+    uint64_t i;
+
+    if(type < 0 || type > 5) return NULL;
+
+    //Multiple threads may load the index at once, only one copy is kept
+    idx = __atomic_load_n(&(fp->hdr->zoomHdrs->idx[level]), __ATOMIC_ACQUIRE);
+    if(!idx) {
+        idx = bwReadIndex(fp, fp->hdr->zoomHdrs->indexOffset[level]);
+        if(!idx) return NULL;
+        if(!__atomic_compare_exchange_n(&(fp->hdr->zoomHdrs->idx[level]), &expected, idx, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            bwDestroyIndex(idx);
+            idx = expected;
         }
-        destroyVals_t(v);
     }
+    errno = 0; //Sometimes libCurls sets and then doesn't unset errno on errors
 
-    return o;
-
-error:
-    destroyVals_t(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
-}
-
-static double intMax(bwOverlappingIntervals_t* ints) {
-    uint32_t i;
-    double o;
-
-    if(ints->l < 1) return strtod("NaN", NULL);
-
-    o = ints->value[0];
-    for(i=1; i<ints->l; i++) {
-        if(ints->value[i] > o) o = ints->value[i];
+    output = malloc(sizeof(double)*nBins);
+    bins = calloc(nBins, sizeof(struct zoomBin_t));
+    bounds = malloc(sizeof(uint32_t)*(nBins+1));
+    if(!output || !bins || !bounds) goto error;
+    if(fp->hdr->bufSize) {
+        buf = malloc(fp->hdr->bufSize);
+        if(!buf) goto error;
     }
 
-    return o;
-}
-
-static double blockMin(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j, isNA = 1;
-    double o = strtod("NaN", NULL);
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return o;
+    bounds[0] = start;
+    for(i=0; i<nBins; i++) bounds[i+1] = start + ((double)(end-start)*(i+1))/((int) nBins);
 
-    //Iterate the blocks
+    //Each zoom block is read and decompressed once, with its records added to every bin they overlap
+    blocks = walkRTreeNodes(fp, idx->root, tid, start, end);
+    if(!blocks) goto error;
     for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            if(isNA) {
-                o = v->vals[j]->min;
-                isNA = 0;
-            } else if(v->vals[j]->min < o) o = v->vals[j]->min;
+        block = bwGetBlock(fp, blocks, i, &compBuf, buf, &sz);
+        if(!block) goto error;
+        for(off=0; off + 32 <= sz; off += 32) {
+            p = (const uint32_t*) ((const char*) block + off);
+            if(p[0] > tid || (p[0] == tid && p[1] > end)) break;
+            if(p[0] == tid) binZoomRecord(bins, bounds, nBins, p);
         }
-        destroyVals_t(v);
     }
 
-    return o;
+    for(i=0; i<nBins; i++) output[i] = zoomStat(bins + i, bounds[i+1] - bounds[i], type);
+
+    destroyBWOverlapBlock(blocks);
+    bwFreeBlockBuffer(&compBuf);
+    free(buf);
+    free(bounds);
+    free(bins);
+    return output;
 
 error:
-    destroyVals_t(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
+    if(!errno) errno = ENOMEM;
+    fprintf(stderr, "got an error in bwStatsFromZoom in the range %"PRIu32"-%"PRIu32": %s\n", start, end, strerror(errno));
+    if(blocks) destroyBWOverlapBlock(blocks);
+    bwFreeBlockBuffer(&compBuf);
+    free(buf);
+    free(bounds);
+    free(bins);
+    free(output);
+    return NULL;
 }
 
-static double intMin(bwOverlappingIntervals_t* ints) {
-    uint32_t i;
-    double o;
-
-    if(ints->l < 1) return strtod("NaN", NULL);
+/// @cond SKIP
+//The running statistics of a bin, with each base weighted equally
+struct binStats_t {
+    double nBases, sum;
+    double total; //What's reported for type=sum, with each product of length and value in single precision as in earlier releases
+    double shift, dSum, dSumSq; //The sums of differences from shift, which is the first value added, and of their squares
+    double min, max;
+};
+/// @endcond
 
-    o = ints->value[0];
-    for(i=1; i<ints->l; i++) {
-        if(ints->value[i] < o) o = ints->value[i];
+//Add nBases bases with a given value. Summing differences from a value near the mean keeps the variance accurate without any division.
+static void addToBin(struct binStats_t *b, uint32_t nBases, float value) {
+    double d;
+    if(b->nBases == 0) {
+        b->shift = b->min = b->max = value;
+    } else {
+        if(value < b->min) b->min = value;
+        if(value > b->max) b->max = value;
     }
-
-    return o;
+    d = value - b->shift;
+    b->nBases += nBases;
+    b->sum += nBases * (double) value;
+    b->total += nBases * value;
+    b->dSum += nBases * d;
+    b->dSumSq += nBases * d * d;
 }
 
-//Does UCSC compensate for only partial block/interval overlap?
-static double blockCoverage(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j;
-    double o = 0.0;
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return strtod("NaN", NULL);
-
-    //Iterate over the blocks
-    for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            o+= v->vals[j]->nBases * v->vals[j]->scalar;
-        }
-        destroyVals_t(v);
+//The statistic of a bin covering len bases, which is NaN if nothing in it is covered
+static double binStat(const struct binStats_t *b, uint32_t len, enum bwStatsType type) {
+    if(b->nBases == 0) return strtod("NaN", NULL);
+    switch(type) {
+    default :
+    case 0:
+        return b->sum / b->nBases;
+    case 1:
+        if(b->nBases >= 2) return sqrt(fmax(b->dSumSq - b->dSum * b->dSum / b->nBases, 0.0) / (b->nBases - 1));
+        return 0.0;
+    case 2:
+        return b->max;
+    case 3:
+        return b->min;
+    case 4:
+        return b->nBases / len;
+    case 5:
+        return b->total;
     }
-
-    if(o == 0.0) return strtod("NaN", NULL);
-    return o;
-
-error:
-    destroyVals_t(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
 }
 
-static double intCoverage(bwOverlappingIntervals_t* ints, uint32_t start, uint32_t end) {
-    uint32_t i, start_use, end_use;
-    double o = 0.0;
-
-    if(!ints->l) return strtod("NaN", NULL);
+//Split each interval across the bins it overlaps, where bin i runs from bounds[i] to bounds[i+1]
+static void binIntervals(const bwOverlappingIntervals_t *ints, const uint32_t *bounds, uint64_t nBins, struct binStats_t *bins) {
+    uint32_t i, s, e, binEnd;
+    uint64_t bin = 0, hi, mid;
 
     for(i=0; i<ints->l; i++) {
-        start_use = ints->start[i];
-        end_use = ints->end[i];
-        if(start_use < start) start_use = start;
-        if(end_use > end) end_use = end;
-        o += end_use - start_use;
-    }
-
-    return o/(end-start);
-}
-
-static double blockSum(bigWigFile_t *fp, bwOverlapBlock_t *blocks, uint32_t tid, uint32_t start, uint32_t end) {
-    uint32_t i, j, sizeUse;
-    double o = 0.0;
-    struct vals_t *v = NULL;
-
-    if(!blocks->n) return strtod("NaN", NULL);
-
-    //Iterate over the blocks
-    for(i=0; i<blocks->n; i++) {
-        v = getVals(fp, blocks, i, tid, start, end);
-        if(!v) goto error;
-        for(j=0; j<v->n; j++) {
-            //Multiply the block average by min(bases covered, block overlap with interval)
-            sizeUse = v->vals[j]->scalar;
-            if(sizeUse > v->vals[j]->nBases) sizeUse = v->vals[j]->nBases;
-            o+= (v->vals[j]->sum * sizeUse) / v->vals[j]->nBases;
+        s = (ints->start[i] < bounds[0]) ? bounds[0] : ints->start[i];
+        e = (ints->end[i] > bounds[nBins]) ? bounds[nBins] : ints->end[i];
+        if(s >= e) continue;
+
+        //Find the last bin starting at or before s. Intervals are sorted, so this is usually the bin the previous one ended in.
+        if(bounds[bin] > s) {
+            bin = 0;
+            hi = nBins;
+            while(hi - bin > 1) {
+                mid = bin + (hi - bin) / 2;
+                if(bounds[mid] <= s) bin = mid;
+                else hi = mid;
+            }
         }
-        destroyVals_t(v);
-    }
+        while(bounds[bin + 1] <= s) bin++;
 
-    if(o == 0.0) return strtod("NaN", NULL);
-    return o;
-
-error:
-    destroyVals_t(v);
-    errno = ENOMEM;
-    return strtod("NaN", NULL);
-}
-
-static double intSum(bwOverlappingIntervals_t* ints, uint32_t start, uint32_t end) {
-    uint32_t i, start_use, end_use;
-    double o = 0.0;
-
-    if(!ints->l) return strtod("NaN", NULL);
-
-    for(i=0; i<ints->l; i++) {
-        start_use = ints->start[i];
-        end_use = ints->end[i];
-        if(start_use < start) start_use = start;
-        if(end_use > end) end_use = end;
-        o += (end_use - start_use) * ints->value[i];
+        while(s < e) {
+            binEnd = (bounds[bin + 1] > e) ? e : bounds[bin + 1];
+            if(binEnd > s) addToBin(bins + bin, binEnd - s, ints->value[i]);
+            s = binEnd;
+            if(s < e) bin++;
+        }
     }
-
-    return o;
 }
 
+//Fetch the intervals from bounds[0] to bounds[nBins] once and sweep them into the bins
 //Returns NULL on error, otherwise a double* that needs to be free()d
-static double *bwStatsFromZoom(bigWigFile_t *fp, int32_t level, uint32_t tid, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type) {
-    bwOverlapBlock_t *blocks = NULL;
+static double *binnedStats(bigWigFile_t *fp, uint32_t tid, const uint32_t *bounds, uint64_t nBins, enum bwStatsType type) {
+    bwOverlappingIntervals_t *ints = NULL;
+    struct binStats_t *bins = NULL;
     double *output = NULL;
-    uint32_t pos = start, i, end2;
+    uint64_t i;
 
-    if(!fp->hdr->zoomHdrs->idx[level]) {
-        fp->hdr->zoomHdrs->idx[level] = bwReadIndex(fp, fp->hdr->zoomHdrs->indexOffset[level]);
-        if(!fp->hdr->zoomHdrs->idx[level]) return NULL;
-    }
-    errno = 0; //Sometimes libCurls sets and then doesn't unset errno on errors
+    bins = calloc(nBins, sizeof(struct binStats_t));
+    output = malloc(sizeof(double) * nBins);
+    if(!bins || !output) goto error;
 
-    output = malloc(sizeof(double)*nBins);
-    if(!output) return NULL;
-
-    for(i=0, pos=start; i<nBins; i++) {
-        end2 = start + ((double)(end-start)*(i+1))/((int) nBins);
-        blocks = walkRTreeNodes(fp, fp->hdr->zoomHdrs->idx[level]->root, tid, pos, end2);
-        if(!blocks) goto error;
-
-        switch(type) {
-        case 0:
-            //mean
-            output[i] = blockMean(fp, blocks, tid, pos, end2);
-            break;
-        case 1:
-            //stdev
-            output[i] = blockDev(fp, blocks, tid, pos, end2);
-            break;
-        case 2:
-            //max
-            output[i] = blockMax(fp, blocks, tid, pos, end2);
-            break;
-        case 3:
-            //min
-            output[i] = blockMin(fp, blocks, tid, pos, end2);
-            break;
-        case 4:
-            //cov
-            output[i] = blockCoverage(fp, blocks, tid, pos, end2)/(end2-pos);
-            break;
-        case 5:
-            //sum
-            output[i] = blockSum(fp, blocks, tid, pos, end2);
-            break;
-        default:
-            goto error;
-            break;
-        }
-        if(errno) goto error;
-        destroyBWOverlapBlock(blocks);
-        pos = end2;
-    }
+    //A range without any intervals gives NULL
+    ints = bwGetOverlappingIntervalsTid(fp, tid, bounds[0], bounds[nBins]);
+    if(ints) binIntervals(ints, bounds, nBins, bins);
+    for(i=0; i<nBins; i++) output[i] = binStat(bins + i, bounds[i + 1] - bounds[i], type);
 
+    free(bins);
+    bwDestroyOverlappingIntervals(ints);
     return output;
 
 error:
-    fprintf(stderr, "got an error in bwStatsFromZoom in the range %"PRIu32"-%"PRIu32": %s\n", pos, end2, strerror(errno));
-    if(blocks) destroyBWOverlapBlock(blocks);
-    if(output) free(output);
+    free(bins);
+    free(output);
     return NULL;
 }
 
 double *bwStatsFromFull(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type) {
-    bwOverlappingIntervals_t *ints = NULL;
-    double *output = malloc(sizeof(double)*nBins);
-    uint32_t i, pos = start, end2;
-    if(!output) return NULL;
+    uint32_t *bounds = malloc(sizeof(uint32_t) * ((uint64_t) nBins + 1));
+    double *output;
+    uint32_t i;
+    if(!bounds) return NULL;
 
-    for(i=0; i<nBins; i++) {
-        end2 = start + ((double)(end-start)*(i+1))/((int) nBins);
-        ints = bwGetOverlappingIntervals(fp, chrom, pos, end2);
+    bounds[0] = start;
+    for(i=0; i<nBins; i++) bounds[i+1] = start + ((double)(end-start)*(i+1))/((int) nBins);
+    output = binnedStats(fp, bwGetTid(fp, chrom), bounds, nBins, type);
 
-        if(!ints) {
-            output[i] = strtod("NaN", NULL);
-            continue;
-        }
+    free(bounds);
+    return output;
+}
 
-        switch(type) {
-        default :
-        case 0:
-            output[i] = intMean(ints, pos, end2);
-            break;
-        case 1:
-            output[i] = intDev(ints, pos, end2);
-            break;
-        case 2:
-            output[i] = intMax(ints);
-            break;
-        case 3:
-            output[i] = intMin(ints);
-            break;
-        case 4:
-            output[i] = intCoverage(ints, pos, end2);
-            break;
-        case 5:
-            output[i] = intSum(ints, pos, end2);
-            break;
-        }
-        bwDestroyOverlappingIntervals(ints);
-        pos = end2;
-    }
+double *bwGetBinnedValues(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t binSize, enum bwStatsType type) {
+    uint32_t *bounds = NULL, tid = bwGetTid(fp, chrom);
+    double *output;
+    uint64_t i, nBins;
+
+    if(tid == (uint32_t) -1 || !binSize || end <= start) return NULL;
+    nBins = ((uint64_t) end - start + binSize - 1) / binSize;
+    bounds = malloc(sizeof(uint32_t) * (nBins + 1));
+    if(!bounds) return NULL;
+
+    //The last bin may be shorter than the others
+    for(i=0; i<nBins; i++) bounds[i] = start + i * binSize;
+    bounds[nBins] = end;
+    output = binnedStats(fp, tid, bounds, nBins, type);
 
+    free(bounds);
     return output;
 }
 
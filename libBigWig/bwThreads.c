@@ -0,0 +1,113 @@
+#include "bigWig.h"
+#include "bwCommon.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+/// @cond SKIP
+struct bwJob_t {
+    void (*func)(void *arg, uint64_t task);
+    void *arg;
+    uint64_t nTasks, nextTask, nDone;
+    pthread_cond_t finished;
+    struct bwJob_t *next; //The next queued job
+};
+/// @endcond
+
+//The pool is shared by all files, and every queued job is run by whichever threads are free
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static struct bwJob_t *firstJob = NULL, *lastJob = NULL;
+static pthread_t *workers = NULL;
+static int nWorkers = 0, stopWorkers = 0;
+
+//Claim the next task of the first queued job, dequeueing it once every task is claimed. poolLock must be held.
+static struct bwJob_t *claimTask(uint64_t *task) {
+    struct bwJob_t *job = firstJob;
+    if(!job) return NULL;
+    *task = job->nextTask++;
+    if(job->nextTask == job->nTasks) {
+        firstJob = job->next;
+        if(!firstJob) lastJob = NULL;
+    }
+    return job;
+}
+
+//Run a claimed task. poolLock must be held and is released while the task runs.
+static void runTask(struct bwJob_t *job, uint64_t task) {
+    pthread_mutex_unlock(&poolLock);
+    job->func(job->arg, task);
+    pthread_mutex_lock(&poolLock);
+    if(++job->nDone == job->nTasks) pthread_cond_signal(&(job->finished));
+}
+
+//Workers take their jobs from the shared queue, so arg is unused
+static void *worker(void *arg) {
+    struct bwJob_t *job;
+    uint64_t task;
+    (void) arg;
+
+    pthread_mutex_lock(&poolLock);
+    while(1) {
+        while(!firstJob && !stopWorkers) pthread_cond_wait(&poolWork, &poolLock);
+        if(stopWorkers) break;
+        job = claimTask(&task);
+        runTask(job, task);
+    }
+    pthread_mutex_unlock(&poolLock);
+    return NULL;
+}
+
+static void joinWorkers(void) {
+    int i;
+    pthread_mutex_lock(&poolLock);
+    stopWorkers = 1;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolLock);
+    for(i=0; i<nWorkers; i++) pthread_join(workers[i], NULL);
+    free(workers);
+    workers = NULL;
+    nWorkers = 0;
+    stopWorkers = 0;
+}
+
+int bwSetThreads(int n) {
+    int rv = 0;
+    joinWorkers();
+    if(n <= 1) return 0;
+
+    workers = malloc((n-1) * sizeof(pthread_t));
+    if(!workers) return 1;
+    //The thread running a query takes part too, so only n-1 workers are needed
+    for(nWorkers=0; nWorkers<n-1; nWorkers++) {
+        if(pthread_create(workers + nWorkers, NULL, worker, NULL)) {
+            rv = 1;
+            break;
+        }
+    }
+    return rv;
+}
+
+int bwGetThreads(void) {
+    return nWorkers + 1;
+}
+
+void bwParallelFor(uint64_t nTasks, void (*func)(void *arg, uint64_t task), void *arg) {
+    struct bwJob_t job = {func, arg, nTasks, 0, 0, PTHREAD_COND_INITIALIZER, NULL}, *claimed;
+    uint64_t task;
+
+    if(!nTasks) return;
+    pthread_mutex_lock(&poolLock);
+    if(lastJob) lastJob->next = &job;
+    else firstJob = &job;
+    lastJob = &job;
+    pthread_cond_broadcast(&poolWork);
+
+    //Help out until every task of this job has been started, then wait for the rest to finish
+    while(job.nextTask < job.nTasks) {
+        claimed = claimTask(&task);
+        runTask(claimed, task);
+    }
+    while(job.nDone < job.nTasks) pthread_cond_wait(&(job.finished), &poolLock);
+    pthread_mutex_unlock(&poolLock);
+    pthread_cond_destroy(&(job.finished));
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <zlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 static uint32_t roundup(uint32_t v) {
     v--;
@@ -20,15 +21,13 @@ static uint32_t roundup(uint32_t v) {
 //Returns the root node on success and NULL on error
 static bwRTree_t *readRTreeIdx(bigWigFile_t *fp, uint64_t offset) {
     uint32_t magic;
+    uint8_t buf[48];
     bwRTree_t *node;
 
-    if(!offset) {
-        if(bwSetPos(fp, fp->hdr->indexOffset)) return NULL;
-    } else {
-        if(bwSetPos(fp, offset)) return NULL;
-    }
+    if(!offset) offset = fp->hdr->indexOffset;
 
-    if(bwRead(&magic, sizeof(uint32_t), 1, fp) != 1) return NULL;
+    if(bwReadAt(fp, offset, buf, 48) != 48) return NULL;
+    memcpy(&magic, buf, sizeof(uint32_t));
     if(magic != IDX_MAGIC) {
         fprintf(stderr, "[readRTreeIdx] Mismatch in the magic number!\n");
         return NULL;
@@ -37,47 +36,41 @@ static bwRTree_t *readRTreeIdx(bigWigFile_t *fp, uint64_t offset) {
     node = calloc(1, sizeof(bwRTree_t));
     if(!node) return NULL;
 
-    if(bwRead(&(node->blockSize), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nItems), sizeof(uint64_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->chrIdxStart), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->baseStart), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->chrIdxEnd), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->baseEnd), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->idxSize), sizeof(uint64_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nItemsPerSlot), sizeof(uint32_t), 1, fp) != 1) goto error;
-    //Padding
-    if(bwRead(&(node->blockSize), sizeof(uint32_t), 1, fp) != 1) goto error;
-    node->rootOffset = bwTell(fp);
+    memcpy(&(node->blockSize), buf + 4, sizeof(uint32_t));
+    memcpy(&(node->nItems), buf + 8, sizeof(uint64_t));
+    memcpy(&(node->chrIdxStart), buf + 16, sizeof(uint32_t));
+    memcpy(&(node->baseStart), buf + 20, sizeof(uint32_t));
+    memcpy(&(node->chrIdxEnd), buf + 24, sizeof(uint32_t));
+    memcpy(&(node->baseEnd), buf + 28, sizeof(uint32_t));
+    memcpy(&(node->idxSize), buf + 32, sizeof(uint64_t));
+    memcpy(&(node->nItemsPerSlot), buf + 40, sizeof(uint32_t));
+    //4 bytes of padding
+    node->rootOffset = offset + 48;
 
     //For remote files, libCurl sometimes sets errno to 115 and doesn't clear it
     errno = 0;
 
     return node;
-
-error:
-    free(node);
-    return NULL;
 }
 
 //Returns a bwRTreeNode_t on success and NULL on an error
 //For the root node, set offset to 0
 static bwRTreeNode_t *bwGetRTreeNode(bigWigFile_t *fp, uint64_t offset) {
     bwRTreeNode_t *node = NULL;
-    uint8_t padding;
+    uint8_t hdr[4], *buf = NULL;
+    const uint8_t *p;
+    size_t itemSize, len;
     uint16_t i;
-    if(offset) {
-        if(bwSetPos(fp, offset)) return NULL;
-    } else {
-        //seek
-        if(bwSetPos(fp, fp->idx->rootOffset)) return NULL;
-    }
+    if(!offset) offset = fp->idx->rootOffset;
 
     node = calloc(1, sizeof(bwRTreeNode_t));
     if(!node) return NULL;
 
-    if(bwRead(&(node->isLeaf), sizeof(uint8_t), 1, fp) != 1) goto error;
-    if(bwRead(&padding, sizeof(uint8_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nChildren), sizeof(uint16_t), 1, fp) != 1) goto error;
+    //isLeaf is followed by a byte of padding
+    if(bwReadAt(fp, offset, hdr, 4) != 4) goto error;
+    node->isLeaf = hdr[0];
+    memcpy(&(node->nChildren), hdr + 2, sizeof(uint16_t));
+    offset += 4;
 
     node->chrIdxStart = malloc(sizeof(uint32_t)*(node->nChildren));
     if(!node->chrIdxStart) goto error;
@@ -96,20 +89,31 @@ static bwRTreeNode_t *bwGetRTreeNode(bigWigFile_t *fp, uint64_t offset) {
         node->x.child = calloc(node->nChildren, sizeof(struct bwRTreeNode_t *));
         if(!node->x.child) goto error;
     }
-    for(i=0; i<node->nChildren; i++) {
-        if(bwRead(&(node->chrIdxStart[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->baseStart[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->chrIdxEnd[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->baseEnd[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->dataOffset[i]), sizeof(uint64_t), 1, fp) != 1) goto error;
-        if(node->isLeaf) {
-            if(bwRead(&(node->x.size[i]), sizeof(uint64_t), 1, fp) != 1) goto error;
-        }
+
+    //Read all of the items at once, leaf items also hold the size of a data block
+    itemSize = (node->isLeaf) ? 32 : 24;
+    len = itemSize * node->nChildren;
+    p = bwReadPtr(fp, offset, len);
+    if(!p && len) {
+        buf = malloc(len);
+        if(!buf) goto error;
+        if(bwReadAt(fp, offset, buf, len) != len) goto error;
+        p = buf;
+    }
+    for(i=0; i<node->nChildren; i++, p+=itemSize) {
+        memcpy(&(node->chrIdxStart[i]), p, sizeof(uint32_t));
+        memcpy(&(node->baseStart[i]), p + 4, sizeof(uint32_t));
+        memcpy(&(node->chrIdxEnd[i]), p + 8, sizeof(uint32_t));
+        memcpy(&(node->baseEnd[i]), p + 12, sizeof(uint32_t));
+        memcpy(&(node->dataOffset[i]), p + 16, sizeof(uint64_t));
+        if(node->isLeaf) memcpy(&(node->x.size[i]), p + 24, sizeof(uint64_t));
     }
+    free(buf);
 
     return node;
 
 error:
+    free(buf);
     if(node->chrIdxStart) free(node->chrIdxStart);
     if(node->baseStart) free(node->baseStart);
     if(node->chrIdxEnd) free(node->chrIdxEnd);
@@ -121,6 +125,15 @@ error:
     return NULL;
 }
 
+//Nodes are loaded lazily and a file may be queried by multiple threads at once, so a node may be loaded by more than one thread.
+//Only the first node stored in *slot is kept, any others are destroyed. Returns the node held in *slot.
+static bwRTreeNode_t *publishRTreeNode(bwRTreeNode_t **slot, bwRTreeNode_t *node) {
+    bwRTreeNode_t *expected = NULL;
+    if(__atomic_compare_exchange_n(slot, &expected, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return node;
+    bwDestroyIndexNode(node);
+    return expected;
+}
+
 void destroyBWOverlapBlock(bwOverlapBlock_t *b) {
     if(!b) return;
     if(b->size) free(b->size);
@@ -225,6 +238,7 @@ error:
 //The output needs to be free()d if not NULL (likewise with *sizes)
 static bwOverlapBlock_t *overlapsNonLeaf(bigWigFile_t *fp, bwRTreeNode_t *node, uint32_t tid, uint32_t start, uint32_t end) {
     uint16_t i;
+    bwRTreeNode_t *child;
     bwOverlapBlock_t *nodeBlocks, *output = calloc(1, sizeof(bwOverlapBlock_t));
     if(!output) return NULL;
 
@@ -242,14 +256,17 @@ static bwOverlapBlock_t *overlapsNonLeaf(bigWigFile_t *fp, bwRTreeNode_t *node,
         }
 
         //We have an overlap!
-        if(!node->x.child[i])
-          node->x.child[i] = bwGetRTreeNode(fp, node->dataOffset[i]);
-        if(!node->x.child[i]) goto error;
+        child = __atomic_load_n(&(node->x.child[i]), __ATOMIC_ACQUIRE);
+        if(!child) {
+            child = bwGetRTreeNode(fp, node->dataOffset[i]);
+            if(!child) goto error;
+            child = publishRTreeNode(&(node->x.child[i]), child);
+        }
 
-        if(node->x.child[i]->isLeaf) { //leaf
-            nodeBlocks = overlapsLeaf(node->x.child[i], tid, start, end);
+        if(child->isLeaf) { //leaf
+            nodeBlocks = overlapsLeaf(child, tid, start, end);
         } else { //non-leaf
-            nodeBlocks = overlapsNonLeaf(fp, node->x.child[i], tid, start, end);
+            nodeBlocks = overlapsNonLeaf(fp, child, tid, start, end);
         }
 
         //The output is processed the same regardless of leaf/non-leaf
@@ -270,44 +287,579 @@ error:
     return NULL;
 }
 
+/// @cond SKIP
+struct blockPair_t {
+    uint64_t offset, size;
+};
+/// @endcond
+
+static int cmpBlockPairs(const void *a, const void *b) {
+    const struct blockPair_t *p1 = a, *p2 = b;
+    if(p1->offset < p2->offset) return -1;
+    return (p1->offset > p2->offset);
+}
+
+//Blocks are nearly always listed in file order already, but bwReadBlock relies on it
+//Returns 0 on success and -1 on error
+static int sortOverlapBlocks(bwOverlapBlock_t *o) {
+    struct blockPair_t *p;
+    uint64_t i;
+
+    for(i=1; i<o->n; i++) {
+        if(o->offset[i] < o->offset[i-1]) break;
+    }
+    if(i >= o->n) return 0;
+
+    p = malloc(sizeof(struct blockPair_t) * o->n);
+    if(!p) return -1;
+    for(i=0; i<o->n; i++) {
+        p[i].offset = o->offset[i];
+        p[i].size = o->size[i];
+    }
+    qsort(p, o->n, sizeof(struct blockPair_t), cmpBlockPairs);
+    for(i=0; i<o->n; i++) {
+        o->offset[i] = p[i].offset;
+        o->size[i] = p[i].size;
+    }
+    free(p);
+    return 0;
+}
+
+//For local files, have the OS start reading all of the blocks now, so that disk latency overlaps with decompressing
+//the blocks that have already arrived. Remote files instead fetch blocks a few ranges at a time in bwReadBlock.
+static void adviseBlocks(bigWigFile_t *bw, const bwOverlapBlock_t *o) {
+    size_t *pos, *len, n = 0;
+    uint64_t i;
+
+    if(o->n < 2 || !urlIsLocal(bw->URL)) return;
+    pos = malloc(o->n * sizeof(size_t));
+    len = malloc(o->n * sizeof(size_t));
+    if(!pos || !len) goto cleanup;
+
+    for(i=0; i<o->n; i++) {
+        if(n && o->offset[i] >= pos[n-1] && o->offset[i] <= pos[n-1] + len[n-1] + BW_BLOCK_GAP) {
+            if(o->offset[i] + o->size[i] > pos[n-1] + len[n-1]) len[n-1] = o->offset[i] + o->size[i] - pos[n-1];
+            continue;
+        }
+        pos[n] = o->offset[i];
+        len[n++] = o->size[i];
+    }
+    urlPrefetch(bw->URL, n, pos, len);
+
+cleanup:
+    free(pos);
+    free(len);
+}
+
+//Put the blocks in file order and start reading them, destroying o on error
+static bwOverlapBlock_t *finishOverlapBlocks(bigWigFile_t *bw, bwOverlapBlock_t *o) {
+    if(o && sortOverlapBlocks(o)) {
+        destroyBWOverlapBlock(o);
+        return NULL;
+    }
+    if(o) adviseBlocks(bw, o);
+    return o;
+}
+
 //Returns NULL and sets nOverlaps to >0 on error, otherwise nOverlaps is the number of file offsets returned
 //The output must be free()d
 bwOverlapBlock_t *walkRTreeNodes(bigWigFile_t *bw, bwRTreeNode_t *root, uint32_t tid, uint32_t start, uint32_t end) {
-    if(root->isLeaf) return overlapsLeaf(root, tid, start, end);
-    return overlapsNonLeaf(bw, root, tid, start, end);
+    bwOverlapBlock_t *o;
+    if(root->isLeaf) o = overlapsLeaf(root, tid, start, end);
+    else o = overlapsNonLeaf(bw, root, tid, start, end);
+
+    return finishOverlapBlocks(bw, o);
+}
+
+//Like overlapsLeaf(), but with a binary search for the first block that can overlap
+//Returns NULL on error
+static bwOverlapBlock_t *overlapsFlat(const bwFlatIndex_t *flat, uint32_t tid, uint32_t start, uint32_t end) {
+    uint64_t qStart = ((uint64_t) tid << 32) | start, qEnd = ((uint64_t) tid << 32) | end;
+    uint64_t lo = 0, hi = flat->n, mid, i, idx = 0;
+    bwOverlapBlock_t *o = calloc(1, sizeof(bwOverlapBlock_t));
+    if(!o) return NULL;
+
+    //Every block before lo ends at or before qStart
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(flat->maxEnd[mid] <= qStart) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for(i=lo; i<flat->n && flat->start[i] < qEnd; i++) {
+        if(flat->end[i] > qStart) o->n++;
+    }
+    if(!o->n) return o;
+
+    o->offset = malloc(sizeof(uint64_t) * o->n);
+    if(!o->offset) goto error;
+    o->size = malloc(sizeof(uint64_t) * o->n);
+    if(!o->size) goto error;
+    for(i=lo; idx<o->n; i++) {
+        if(flat->end[i] <= qStart) continue;
+        o->offset[idx] = flat->offset[i];
+        o->size[idx++] = flat->size[i];
+    }
+
+    return o;
+
+error:
+    destroyBWOverlapBlock(o);
+    return NULL;
+}
+
+static void destroyFlatIndex(bwFlatIndex_t *flat) {
+    if(!flat) return;
+    free(flat->start);
+    free(flat->end);
+    free(flat->maxEnd);
+    free(flat->offset);
+    free(flat->size);
+    free(flat);
+}
+
+/// @cond SKIP
+struct flatLeaf_t {
+    uint64_t start, end, offset, size;
+};
+
+struct flatLeaves_t {
+    uint64_t n, m;
+    struct flatLeaf_t *leaf;
+};
+/// @endcond
+
+static int cmpFlatLeaves(const void *a, const void *b) {
+    const struct flatLeaf_t *l1 = a, *l2 = b;
+    if(l1->start < l2->start) return -1;
+    return (l1->start > l2->start);
+}
+
+//Append all of the leaves under a node, loading nodes as needed
+//Returns 0 on success
+static int collectLeaves(bigWigFile_t *fp, bwRTreeNode_t *node, struct flatLeaves_t *l) {
+    bwRTreeNode_t *child;
+    struct flatLeaf_t *tmp;
+    uint16_t i;
+
+    for(i=0; i<node->nChildren; i++) {
+        if(!node->isLeaf) {
+            child = __atomic_load_n(&(node->x.child[i]), __ATOMIC_ACQUIRE);
+            if(!child) {
+                child = bwGetRTreeNode(fp, node->dataOffset[i]);
+                if(!child) return 1;
+                child = publishRTreeNode(&(node->x.child[i]), child);
+            }
+            if(collectLeaves(fp, child, l)) return 1;
+            continue;
+        }
+
+        if(l->n == l->m) {
+            l->m = (l->m) ? 2 * l->m : 1024;
+            tmp = realloc(l->leaf, l->m * sizeof(struct flatLeaf_t));
+            if(!tmp) return 1;
+            l->leaf = tmp;
+        }
+        l->leaf[l->n].start = ((uint64_t) node->chrIdxStart[i] << 32) | node->baseStart[i];
+        l->leaf[l->n].end = ((uint64_t) node->chrIdxEnd[i] << 32) | node->baseEnd[i];
+        l->leaf[l->n].offset = node->dataOffset[i];
+        l->leaf[l->n++].size = node->x.size[i];
+    }
+    return 0;
+}
+
+static bwFlatIndex_t *flattenRTree(bigWigFile_t *fp, bwRTreeNode_t *root) {
+    struct flatLeaves_t l = {0, 0, NULL};
+    bwFlatIndex_t *flat = NULL;
+    uint64_t i;
+
+    if(collectLeaves(fp, root, &l)) goto error;
+    //Leaves are normally already sorted
+    for(i=1; i<l.n; i++) {
+        if(l.leaf[i].start < l.leaf[i-1].start) break;
+    }
+    if(i < l.n) qsort(l.leaf, l.n, sizeof(struct flatLeaf_t), cmpFlatLeaves);
+
+    flat = calloc(1, sizeof(bwFlatIndex_t));
+    if(!flat) goto error;
+    flat->n = l.n;
+    flat->start = malloc(sizeof(uint64_t) * (l.n + 1));
+    flat->end = malloc(sizeof(uint64_t) * (l.n + 1));
+    flat->maxEnd = malloc(sizeof(uint64_t) * (l.n + 1));
+    flat->offset = malloc(sizeof(uint64_t) * (l.n + 1));
+    flat->size = malloc(sizeof(uint64_t) * (l.n + 1));
+    if(!flat->start || !flat->end || !flat->maxEnd || !flat->offset || !flat->size) goto error;
+    for(i=0; i<l.n; i++) {
+        flat->start[i] = l.leaf[i].start;
+        flat->end[i] = l.leaf[i].end;
+        flat->maxEnd[i] = (i && flat->maxEnd[i-1] > l.leaf[i].end) ? flat->maxEnd[i-1] : l.leaf[i].end;
+        flat->offset[i] = l.leaf[i].offset;
+        flat->size[i] = l.leaf[i].size;
+    }
+    free(l.leaf);
+    return flat;
+
+error:
+    free(l.leaf);
+    destroyFlatIndex(flat);
+    return NULL;
+}
+
+void bwFreeBlockBuffer(bwBlockBuffer_t *b) {
+    if(b->offset) free(b->offset);
+    if(b->len) free(b->len);
+    if(b->buf) free(b->buf);
+    b->n = b->m = b->bufSize = 0;
+    b->offset = b->len = NULL;
+    b->buf = NULL;
+}
+
+//Returns NULL on error
+const void *bwReadBlock(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint64_t i, bwBlockBuffer_t *b) {
+    uint64_t start = o->offset[i], end = o->offset[i] + o->size[i], j;
+    size_t k, pos, total = 0, nRanges = 1;
+    const void *block = bwReadPtr(fp, o->offset[i], o->size[i]);
+    void *tmp;
+
+    //Memory-mapped files can be decompressed in place
+    if(block) return block;
+
+    for(k=0, pos=0; k<b->n; pos+=b->len[k++]) {
+        if(start >= b->offset[k] && end <= b->offset[k] + b->len[k]) return (char*)b->buf + pos + (start - b->offset[k]);
+    }
+
+    //Remote files can fetch the next few ranges concurrently
+    if(!urlIsLocal(fp->URL)) nRanges = GLOBAL_REMOTEPARALLELISM;
+    if(b->m < nRanges) {
+        tmp = realloc(b->offset, nRanges * sizeof(size_t));
+        if(!tmp) return NULL;
+        b->offset = tmp;
+        tmp = realloc(b->len, nRanges * sizeof(size_t));
+        if(!tmp) return NULL;
+        b->len = tmp;
+        b->m = nRanges;
+    }
+
+    b->n = 0;
+    for(j=i; j<o->n && b->n<nRanges;) {
+        //Extend each range over any following blocks that are close by
+        start = o->offset[j];
+        end = o->offset[j] + o->size[j];
+        for(j++; j<o->n; j++) {
+            if(o->offset[j] < start || o->offset[j] > end + BW_BLOCK_GAP) break;
+            if(o->offset[j] + o->size[j] - start > BW_MAX_BLOCK_RANGE) break;
+            if(o->offset[j] + o->size[j] > end) end = o->offset[j] + o->size[j];
+        }
+        b->offset[b->n] = start;
+        b->len[b->n++] = end - start;
+        total += end - start;
+    }
+
+    if(total > b->bufSize) {
+        tmp = realloc(b->buf, total);
+        if(!tmp) goto error;
+        b->buf = tmp;
+        b->bufSize = total;
+    }
+    if(bwReadRanges(fp, b->n, b->offset, b->len, b->buf)) goto error;
+
+    //The first range starts with block i
+    return b->buf;
+
+error:
+    b->n = 0;
+    return NULL;
+}
+
+/// @cond SKIP
+struct cachedBlock_t {
+    uint64_t offset;
+    size_t len;
+    struct cachedBlock_t *prev, *next; //In order of use, most recent first
+    struct cachedBlock_t *hnext; //The next block in the same hash bucket
+    uint8_t data[];
+};
+
+struct bwBlockCache_t {
+    pthread_mutex_t lock;
+    size_t size, maxSize;
+    uint64_t hits, misses;
+    uint64_t nBuckets;
+    struct cachedBlock_t **bucket;
+    struct cachedBlock_t *first, *last;
+};
+/// @endcond
+
+struct bwBlockCache_t *bwCreateBlockCache(size_t size) {
+    struct bwBlockCache_t *cache = calloc(1, sizeof(struct bwBlockCache_t));
+    if(!cache) return NULL;
+
+    //Blocks are typically around 32KiB once decompressed
+    cache->nBuckets = 64;
+    while(cache->nBuckets < size / 8192) cache->nBuckets <<= 1;
+    cache->bucket = calloc(cache->nBuckets, sizeof(struct cachedBlock_t*));
+    if(!cache->bucket) {
+        free(cache);
+        return NULL;
+    }
+    cache->maxSize = size;
+    pthread_mutex_init(&(cache->lock), NULL);
+    return cache;
+}
+
+void bwDestroyBlockCache(struct bwBlockCache_t *cache) {
+    struct cachedBlock_t *c, *next;
+    if(!cache) return;
+    for(c=cache->first; c; c=next) {
+        next = c->next;
+        free(c);
+    }
+    pthread_mutex_destroy(&(cache->lock));
+    free(cache->bucket);
+    free(cache);
+}
+
+void bwGetBlockCacheStats(bigWigFile_t *fp, uint64_t *hits, uint64_t *misses) {
+    struct bwBlockCache_t *cache = fp->blockCache;
+    *hits = *misses = 0;
+    if(!cache) return;
+    pthread_mutex_lock(&(cache->lock));
+    *hits = cache->hits;
+    *misses = cache->misses;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+static struct cachedBlock_t **cacheBucket(struct bwBlockCache_t *cache, uint64_t offset) {
+    return cache->bucket + ((offset * 0x9E3779B97F4A7C15ULL) >> 32) % cache->nBuckets;
+}
+
+static void unlinkCachedBlock(struct bwBlockCache_t *cache, struct cachedBlock_t *c) {
+    if(c->prev) c->prev->next = c->next;
+    else cache->first = c->next;
+    if(c->next) c->next->prev = c->prev;
+    else cache->last = c->prev;
+}
+
+static void linkCachedBlock(struct bwBlockCache_t *cache, struct cachedBlock_t *c) {
+    c->prev = NULL;
+    c->next = cache->first;
+    if(cache->first) cache->first->prev = c;
+    cache->first = c;
+    if(!cache->last) cache->last = c;
+}
+
+//Copies a block into buf, returning 1 if it's cached and 0 otherwise
+static int getCachedBlock(struct bwBlockCache_t *cache, uint64_t offset, void *buf, size_t *len) {
+    struct cachedBlock_t *c;
+    pthread_mutex_lock(&(cache->lock));
+    for(c=*cacheBucket(cache, offset); c; c=c->hnext) {
+        if(c->offset == offset) break;
+    }
+    if(c) {
+        memcpy(buf, c->data, c->len);
+        *len = c->len;
+        unlinkCachedBlock(cache, c);
+        linkCachedBlock(cache, c);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&(cache->lock));
+    return (c != NULL);
+}
+
+//Add a copy of a block, discarding the least recently used ones as needed
+//Nothing is done on error, since this is only an optimization
+static void cacheBlock(struct bwBlockCache_t *cache, uint64_t offset, const void *data, size_t len) {
+    struct cachedBlock_t *c, **p;
+    if(len > cache->maxSize) return;
+    c = malloc(sizeof(struct cachedBlock_t) + len);
+    if(!c) return;
+    c->offset = offset;
+    c->len = len;
+    memcpy(c->data, data, len);
+
+    pthread_mutex_lock(&(cache->lock));
+    //Another thread may have added this in the meantime
+    for(p=cacheBucket(cache, offset); *p; p=&((*p)->hnext)) {
+        if((*p)->offset == offset) break;
+    }
+    if(*p) {
+        pthread_mutex_unlock(&(cache->lock));
+        free(c);
+        return;
+    }
+    while(cache->last && cache->size + len > cache->maxSize) {
+        struct cachedBlock_t *old = cache->last, **q;
+        for(q=cacheBucket(cache, old->offset); *q != old; q=&((*q)->hnext));
+        *q = old->hnext;
+        unlinkCachedBlock(cache, old);
+        cache->size -= old->len;
+        free(old);
+    }
+    c->hnext = *cacheBucket(cache, offset);
+    *cacheBucket(cache, offset) = c;
+    linkCachedBlock(cache, c);
+    cache->size += len;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+const void *bwGetBlock(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint64_t i, bwBlockBuffer_t *b, void *buf, size_t *len) {
+    size_t sz = fp->hdr->bufSize;
+    const void *block;
+
+    if(sz && fp->blockCache && getCachedBlock(fp->blockCache, o->offset[i], buf, len)) return buf;
+
+    block = bwReadBlock(fp, o, i, b);
+    if(!block) return NULL;
+    if(!sz) {
+        *len = o->size[i];
+        return block;
+    }
+
+    if(bwInflate(buf, &sz, block, o->size[i])) return NULL;
+    *len = sz;
+    if(fp->blockCache) cacheBlock(fp->blockCache, o->offset[i], buf, sz);
+    return buf;
+}
+
+//FNV-1a
+static uint64_t hashChrom(const char *chrom) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(; *chrom; chrom++) {
+        h ^= (uint8_t) *chrom;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int bwBuildChromHash(chromList_t *cl) {
+    uint64_t i, slot, size = 16;
+    uint32_t *hash, *expected = NULL, tid;
+    const char *name;
+
+    if(__atomic_load_n(&(cl->hash), __ATOMIC_ACQUIRE)) return 0;
+    while(size < 2 * (uint64_t) cl->nKeys) size <<= 1;
+    hash = calloc(size, sizeof(uint32_t));
+    if(!hash) return 1;
+
+    for(i=0; i<(uint64_t) cl->nKeys; i++) {
+        //If a name is duplicated, the first instance wins, as it would with a linear search
+        //Other threads may still be filling in a lazily loaded list
+        name = __atomic_load_n(&(cl->chrom[i]), __ATOMIC_ACQUIRE);
+        for(slot = hashChrom(name) & (size - 1); (tid = hash[slot]); slot = (slot + 1) & (size - 1)) {
+            if(strcmp(name, __atomic_load_n(&(cl->chrom[tid - 1]), __ATOMIC_ACQUIRE)) == 0) break;
+        }
+        if(!tid) hash[slot] = i + 1;
+    }
+
+    //Any thread that publishes a table stores the same size first
+    __atomic_store_n(&(cl->hashSize), size, __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&(cl->hash), &expected, hash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) free(hash);
+    return 0;
+}
+
+static uint32_t hashGetTid(const chromList_t *cl, const uint32_t *hash, const char *chrom) {
+    uint64_t mask = __atomic_load_n(&(cl->hashSize), __ATOMIC_RELAXED) - 1, slot;
+    uint32_t i;
+    for(slot = hashChrom(chrom) & mask; (i = hash[slot]); slot = (slot + 1) & mask) {
+        if(strcmp(chrom, cl->chrom[i - 1]) == 0) return i - 1;
+    }
+    return -1;
+}
+
+//Search the on-disk chromosome tree, falling back to reading all of it if the name isn't found
+static uint32_t lazyGetTid(bigWigFile_t *fp, const char *chrom) {
+    chromList_t *cl = fp->cl;
+    uint32_t i = __atomic_load_n(&(cl->lastTid), __ATOMIC_RELAXED);
+    const char *name;
+
+    //Queries typically use the same chromosome over and over
+    if(i < cl->nKeys) {
+        name = __atomic_load_n(&(cl->chrom[i]), __ATOMIC_ACQUIRE);
+        if(name && strcmp(chrom, name) == 0) return i;
+    }
+    if(strlen(chrom) > cl->keySize) return -1;
+
+    i = bwSearchChromTree(fp, chrom);
+    if(i != (uint32_t) -1) {
+        __atomic_store_n(&(cl->lastTid), i, __ATOMIC_RELAXED);
+        return i;
+    }
+    if(bwLoadChroms(fp)) return -1;
+    return hashGetTid(cl, __atomic_load_n(&(cl->hash), __ATOMIC_ACQUIRE), chrom);
 }
 
-//In reality, a hash or some sort of tree structure is probably faster...
 //Return -1 (AKA 0xFFFFFFFF...) on "not there", so we can hold (2^32)-1 items.
 uint32_t bwGetTid(const bigWigFile_t *fp, const char *chrom) {
+    const chromList_t *cl = fp->cl;
+    const uint32_t *hash;
     uint32_t i;
     if(!chrom) return -1;
-    for(i=0; i<fp->cl->nKeys; i++) {
-        if(strcmp(chrom, fp->cl->chrom[i]) == 0) return i;
+
+    hash = __atomic_load_n(&(cl->hash), __ATOMIC_ACQUIRE);
+    if(hash) return hashGetTid(cl, hash, chrom);
+    if(cl->treeOffset) return lazyGetTid((bigWigFile_t *) fp, chrom);
+
+    for(i=0; i<cl->nKeys; i++) {
+        if(strcmp(chrom, cl->chrom[i]) == 0) return i;
     }
     return -1;
 }
 
-static bwOverlapBlock_t *bwGetOverlappingBlocks(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end) {
-    uint32_t tid = bwGetTid(fp, chrom);
-
-    if(tid == (uint32_t) -1) {
-        fprintf(stderr, "[bwGetOverlappingBlocks] Non-existent contig: %s\n", chrom);
-        return NULL;
-    }
+//Return the index of the full data, with at least its root node loaded, or NULL on error
+static bwRTree_t *bwGetIndex(bigWigFile_t *fp) {
+    bwRTree_t *idx, *expected = NULL;
+    bwRTreeNode_t *root;
 
     //Get the info if needed
-    if(!fp->idx) {
-        fp->idx = readRTreeIdx(fp, fp->hdr->indexOffset);
-        if(!fp->idx) {
-            return NULL;
+    idx = __atomic_load_n(&(fp->idx), __ATOMIC_ACQUIRE);
+    if(!idx) {
+        idx = readRTreeIdx(fp, fp->hdr->indexOffset);
+        if(!idx) return NULL;
+        if(!__atomic_compare_exchange_n(&(fp->idx), &expected, idx, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            bwDestroyIndex(idx);
+            idx = expected;
         }
     }
 
-    if(!fp->idx->root) fp->idx->root = bwGetRTreeNode(fp, 0);
-    if(!fp->idx->root) return NULL;
+    root = __atomic_load_n(&(idx->root), __ATOMIC_ACQUIRE);
+    if(!root) {
+        root = bwGetRTreeNode(fp, idx->rootOffset);
+        if(!root) return NULL;
+        root = publishRTreeNode(&(idx->root), root);
+    }
+
+    return idx;
+}
+
+int bwFlattenIndex(bigWigFile_t *fp) {
+    bwFlatIndex_t *flat, *expected = NULL;
+    bwRTree_t *idx;
+
+    if(fp->isWrite || !fp->hdr->indexOffset) return 1;
+    idx = bwGetIndex(fp);
+    if(!idx) return 1;
+    if(__atomic_load_n(&(idx->flat), __ATOMIC_ACQUIRE)) return 0;
+
+    flat = flattenRTree(fp, idx->root);
+    if(!flat) {
+        fprintf(stderr, "[bwFlattenIndex] Couldn't load the index!\n");
+        return 1;
+    }
+    if(!__atomic_compare_exchange_n(&(idx->flat), &expected, flat, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) destroyFlatIndex(flat);
+    return 0;
+}
+
+static bwOverlapBlock_t *bwGetOverlappingBlocks(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end) {
+    bwRTree_t *idx;
+    bwFlatIndex_t *flat;
 
-    return walkRTreeNodes(fp, fp->idx->root, tid, start, end);
+    idx = bwGetIndex(fp);
+    if(!idx) return NULL;
+    flat = __atomic_load_n(&(idx->flat), __ATOMIC_ACQUIRE);
+    if(flat) return finishOverlapBlocks(fp, overlapsFlat(flat, tid, start, end));
+    return walkRTreeNodes(fp, idx->root, tid, start, end);
 }
 
 void bwFillDataHdr(bwDataHeader_t *hdr, void *b) {
@@ -342,10 +894,11 @@ void bbDestroyOverlappingEntries(bbOverlappingEntries_t *o) {
     free(o);
 }
 
+//Make room for at least n more intervals
 //Returns NULL on error, in which case o has been free()d
-static bwOverlappingIntervals_t *pushIntervals(bwOverlappingIntervals_t *o, uint32_t start, uint32_t end, float value) {
-    if(o->l+1 >= o->m) {
-        o->m = roundup(o->l+1);
+static bwOverlappingIntervals_t *reserveIntervals(bwOverlappingIntervals_t *o, uint32_t n) {
+    if(o->l+n >= o->m) {
+        o->m = roundup(o->l+n);
         o->start = realloc(o->start, o->m * sizeof(uint32_t));
         if(!o->start) goto error;
         o->end = realloc(o->end, o->m * sizeof(uint32_t));
@@ -353,9 +906,6 @@ static bwOverlappingIntervals_t *pushIntervals(bwOverlappingIntervals_t *o, uint
         o->value = realloc(o->value, o->m * sizeof(float));
         if(!o->value) goto error;
     }
-    o->start[o->l] = start;
-    o->end[o->l] = end;
-    o->value[o->l++] = value;
     return o;
 
 error:
@@ -363,6 +913,74 @@ error:
     return NULL;
 }
 
+/*
+ * Decoders for each type of data block. Each appends the items overlapping ostart-oend to o, which must already
+ * have room for every item in the block. The loops are free of branches, so that the compiler can vectorize them.
+ */
+
+//bedGraph: start, end and value for each item
+static void decodeBedGraph(const uint32_t *p, uint16_t nItems, uint32_t ostart, uint32_t oend, bwOverlappingIntervals_t *o) {
+    uint32_t *start = o->start + o->l, *end = o->end + o->l, n = 0, j, s, e;
+    float *value = o->value + o->l;
+    for(j=0; j<nItems; j++, p+=3) {
+        s = p[0];
+        e = p[1];
+        start[n] = s;
+        end[n] = e;
+        value[n] = *((const float *)(p+2));
+        n += (e > ostart) & (s < oend);
+    }
+    o->l += n;
+}
+
+//variableStep: start and value for each item, which all have the same span
+static void decodeVarStep(const uint32_t *p, uint16_t nItems, uint32_t span, uint32_t ostart, uint32_t oend, bwOverlappingIntervals_t *o) {
+    uint32_t *start = o->start + o->l, *end = o->end + o->l, n = 0, j, s;
+    float *value = o->value + o->l;
+    for(j=0; j<nItems; j++, p+=2) {
+        s = p[0];
+        start[n] = s;
+        end[n] = s + span;
+        value[n] = *((const float *)(p+1));
+        n += (s + span > ostart) & (s < oend);
+    }
+    o->l += n;
+}
+
+//Find the first and one past the last items of a fixedStep block that overlap ostart-oend
+//Item j covers bstart+j*step to bstart+j*step+span
+static void fixedStepItems(uint16_t nItems, uint32_t bstart, uint32_t step, uint32_t span, uint32_t ostart, uint32_t oend, int64_t *first, int64_t *last) {
+    int64_t d;
+    *first = 0;
+    *last = nItems;
+    if(step) {
+        d = (int64_t) ostart - span - bstart;
+        if(d >= 0) *first = d / step + 1;
+        d = (int64_t) oend - bstart;
+        if(d <= 0) *last = 0;
+        else if((d + step - 1) / step < *last) *last = (d + step - 1) / step;
+    } else if((int64_t) bstart + span <= ostart || bstart >= oend) {
+        *last = 0;
+    }
+}
+
+//fixedStep: only values, so the overlapping items can be found without looking at any of them
+static void decodeFixedStep(const float *p, uint16_t nItems, uint32_t bstart, uint32_t step, uint32_t span, uint32_t ostart, uint32_t oend, bwOverlappingIntervals_t *o) {
+    uint32_t *start = o->start + o->l, *end = o->end + o->l, j;
+    float *value = o->value + o->l;
+    int64_t first, last;
+
+    fixedStepItems(nItems, bstart, step, span, ostart, oend, &first, &last);
+    if(first >= last) return;
+
+    for(j=0; j<last-first; j++) {
+        start[j] = bstart + (first+j) * step;
+        end[j] = start[j] + span;
+        value[j] = p[first+j];
+    }
+    o->l += last-first;
+}
+
 static bbOverlappingEntries_t *pushBBIntervals(bbOverlappingEntries_t *o, uint32_t start, uint32_t end, char *str, int withString) {
     if(o->l+1 >= o->m) {
         o->m = roundup(o->l+1);
@@ -386,151 +1004,196 @@ error:
     return NULL;
 }
 
-//Returns NULL on error
-bwOverlappingIntervals_t *bwGetOverlappingIntervalsCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend) {
-    uint64_t i;
+/*
+ * Like the decoders above, but for bwGetValuesInto(). The value of each position in ostart-oend covered by an item
+ * is written to out, which holds the values of the whole range.
+ */
+
+static void fillValues(float *out, uint32_t s, uint32_t e, uint32_t ostart, uint32_t oend, float value) {
+    if(s < ostart) s = ostart;
+    if(e > oend) e = oend;
+    for(; s < e; s++) out[s - ostart] = value;
+}
+
+static void denseBedGraph(const uint32_t *p, uint16_t nItems, uint32_t ostart, uint32_t oend, float *out) {
     uint16_t j;
-    int compressed = 0, rv;
-    uLongf sz = fp->hdr->bufSize, tmp;
-    void *buf = NULL, *compBuf = NULL;
-    uint32_t start = 0, end , *p;
-    float value;
+    for(j=0; j<nItems; j++, p+=3) fillValues(out, p[0], p[1], ostart, oend, *((const float *)(p+2)));
+}
+
+static void denseVarStep(const uint32_t *p, uint16_t nItems, uint32_t span, uint32_t ostart, uint32_t oend, float *out) {
+    uint16_t j;
+    for(j=0; j<nItems; j++, p+=2) fillValues(out, p[0], p[0] + span, ostart, oend, *((const float *)(p+1)));
+}
+
+static void denseFixedStep(const float *p, uint16_t nItems, uint32_t bstart, uint32_t step, uint32_t span, uint32_t ostart, uint32_t oend, float *out) {
+    int64_t first, last, j;
+    uint32_t s;
+
+    fixedStepItems(nItems, bstart, step, span, ostart, oend, &first, &last);
+    //Per-base values, the most common case, are simply copied
+    if(step == 1 && span == 1) {
+        if(first < last) memcpy(out + (bstart + first - ostart), p + first, (last - first) * sizeof(float));
+        return;
+    }
+    for(j=first; j<last; j++) {
+        s = bstart + j * step;
+        fillValues(out, s, s + span, ostart, oend, p[j]);
+    }
+}
+
+//Read the header of a decompressed data block, returning a pointer to its items or NULL if it's too short to hold them
+static const uint32_t *blockItems(const void *block, size_t len, bwDataHeader_t *hdr) {
+    size_t itemSize;
+    if(len < 24) return NULL;
+    bwFillDataHdr(hdr, (void*) block);
+    switch(hdr->type) {
+    case 1:
+        itemSize = 12;
+        break;
+    case 2:
+        itemSize = 8;
+        break;
+    case 3:
+        itemSize = 4;
+        break;
+    default :
+        return NULL;
+    }
+    if(len < 24 + itemSize * hdr->nItems) return NULL;
+    return (const uint32_t*) block + 6;
+}
+
+//Decode every block in o, returning the intervals overlapping ostart-oend or NULL on error
+static bwOverlappingIntervals_t *intervalsFromBlocks(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend) {
+    uint64_t i;
+    int compressed = 0;
+    uLongf sz = fp->hdr->bufSize;
+    size_t len;
+    void *buf = NULL;
+    const void *block;
+    bwBlockBuffer_t compBuf = {0, 0, NULL, NULL, 0, NULL};
+    const uint32_t *p;
     bwDataHeader_t hdr;
     bwOverlappingIntervals_t *output = calloc(1, sizeof(bwOverlappingIntervals_t));
 
     if(!output) goto error;
 
-    if(!o) return output;
-    if(!o->n) return output;
-
     if(sz) {
         compressed = 1;
         buf = malloc(sz);
     }
-    sz = 0; //This is now the size of the compressed buffer
 
     for(i=0; i<o->n; i++) {
-        if(bwSetPos(fp, o->offset[i])) goto error;
-
-        if(sz < o->size[i]) {
-            compBuf = realloc(compBuf, o->size[i]);
-            sz = o->size[i];
-        }
-        if(!compBuf) goto error;
-
-        if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
-        if(compressed) {
-            tmp = fp->hdr->bufSize; //This gets over-written by uncompress
-            rv = uncompress(buf, (uLongf *) &tmp, compBuf, o->size[i]);
-            if(rv != Z_OK) goto error;
-        } else {
-            buf = compBuf;
-        }
-
-        //TODO: ensure that tmp is large enough!
-        bwFillDataHdr(&hdr, buf);
+        block = bwGetBlock(fp, o, i, &compBuf, buf, &len);
+        if(!block) goto error;
 
-        p = ((uint32_t*) buf);
-        p += 6;
+        p = blockItems(block, len, &hdr);
+        if(!p) goto error;
         if(hdr.tid != tid) continue;
 
-        if(hdr.type == 3) start = hdr.start - hdr.step;
-
-        //FIXME: We should ensure that sz is large enough to hold nItems of the given type
-        for(j=0; j<hdr.nItems; j++) {
-            switch(hdr.type) {
-            case 1:
-                start = *p;
-                p++;
-                end = *p;
-                p++;
-                value = *((float *)p);
-                p++;
-                break;
-            case 2:
-                start = *p;
-                p++;
-                end = start + hdr.span;
-                value = *((float *)p);
-                p++;
-                break;
-            case 3:
-                start += hdr.step;
-                end = start+hdr.span;
-                value = *((float *)p);
-                p++;
-                break;
-            default :
-                goto error;
-                break;
-            }
-
-            if(end <= ostart || start >= oend) continue;
-            //Push the overlap
-            if(!pushIntervals(output, start, end, value)) goto error;
+        if(!(output = reserveIntervals(output, hdr.nItems))) goto error;
+        switch(hdr.type) {
+        case 1:
+            decodeBedGraph(p, hdr.nItems, ostart, oend, output);
+            break;
+        case 2:
+            decodeVarStep(p, hdr.nItems, hdr.span, ostart, oend, output);
+            break;
+        case 3:
+            decodeFixedStep((const float *) p, hdr.nItems, hdr.start, hdr.step, hdr.span, ostart, oend, output);
+            break;
         }
     }
 
     if(compressed && buf) free(buf);
-    if(compBuf) free(compBuf);
+    bwFreeBlockBuffer(&compBuf);
     return output;
 
 error:
-    fprintf(stderr, "[bwGetOverlappingIntervalsCore] Got an error\n");
     if(output) bwDestroyOverlappingIntervals(output);
     if(compressed && buf) free(buf);
-    if(compBuf) free(compBuf);
+    bwFreeBlockBuffer(&compBuf);
     return NULL;
 }
 
-bbOverlappingEntries_t *bbGetOverlappingEntriesCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend, int withString) {
+//Like intervalsFromBlocks(), but writing the values into out, which holds ostart-oend
+//Returns 1 on error
+static int valuesFromBlocks(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend, float *out) {
+    uint64_t i;
+    int rv = 1;
+    size_t len;
+    void *buf = NULL;
+    const void *block;
+    bwBlockBuffer_t compBuf = {0, 0, NULL, NULL, 0, NULL};
+    const uint32_t *p;
+    bwDataHeader_t hdr;
+
+    if(fp->hdr->bufSize) {
+        buf = malloc(fp->hdr->bufSize);
+        if(!buf) return 1;
+    }
+
+    for(i=0; i<o->n; i++) {
+        block = bwGetBlock(fp, o, i, &compBuf, buf, &len);
+        if(!block) goto cleanup;
+        p = blockItems(block, len, &hdr);
+        if(!p) goto cleanup;
+        if(hdr.tid != tid) continue;
+
+        switch(hdr.type) {
+        case 1:
+            denseBedGraph(p, hdr.nItems, ostart, oend, out);
+            break;
+        case 2:
+            denseVarStep(p, hdr.nItems, hdr.span, ostart, oend, out);
+            break;
+        case 3:
+            denseFixedStep((const float *) p, hdr.nItems, hdr.start, hdr.step, hdr.span, ostart, oend, out);
+            break;
+        }
+    }
+    rv = 0;
+
+cleanup:
+    free(buf);
+    bwFreeBlockBuffer(&compBuf);
+    return rv;
+}
+
+//Like intervalsFromBlocks(), but for bigBed files
+static bbOverlappingEntries_t *entriesFromBlocks(bigWigFile_t *fp, const bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend, int withString) {
     uint64_t i;
-    int compressed = 0, rv, slen;
-    uLongf sz = fp->hdr->bufSize, tmp = 0;
-    void *buf = NULL, *bufEnd = NULL, *compBuf = NULL;
+    int compressed = 0, slen;
+    uLongf sz = fp->hdr->bufSize;
+    size_t len;
+    void *buf = NULL;
+    const char *block, *blockEnd;
+    bwBlockBuffer_t compBuf = {0, 0, NULL, NULL, 0, NULL};
     uint32_t entryTid = 0, start = 0, end;
     char *str;
     bbOverlappingEntries_t *output = calloc(1, sizeof(bbOverlappingEntries_t));
 
     if(!output) goto error;
 
-    if(!o) return output;
-    if(!o->n) return output;
-
     if(sz) {
         compressed = 1;
         buf = malloc(sz);
     }
-    sz = 0; //This is now the size of the compressed buffer
 
     for(i=0; i<o->n; i++) {
-        if(bwSetPos(fp, o->offset[i])) goto error;
-
-        if(sz < o->size[i]) {
-            compBuf = realloc(compBuf, o->size[i]);
-            sz = o->size[i];
-        }
-        if(!compBuf) goto error;
-
-        if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
-        if(compressed) {
-            tmp = fp->hdr->bufSize; //This gets over-written by uncompress
-            rv = uncompress(buf, (uLongf *) &tmp, compBuf, o->size[i]);
-            if(rv != Z_OK) goto error;
-        } else {
-            buf = compBuf;
-            tmp = o->size[i]; //TODO: Is this correct? Do non-gzipped bigBeds exist?
-        }
-
-        bufEnd = (char*)buf + tmp;
-        while(buf < bufEnd) {
-            entryTid = ((uint32_t*)buf)[0];
-            start = ((uint32_t*)buf)[1];
-            end = ((uint32_t*)buf)[2];
-            buf = (char*)buf + 12;
-            str = (char*)buf;
+        //TODO: Is len correct for uncompressed blocks? Do non-gzipped bigBeds exist?
+        block = bwGetBlock(fp, o, i, &compBuf, buf, &len);
+        if(!block) goto error;
+
+        blockEnd = block + len;
+        while(block < blockEnd) {
+            entryTid = ((const uint32_t*)block)[0];
+            start = ((const uint32_t*)block)[1];
+            end = ((const uint32_t*)block)[2];
+            block += 12;
+            str = (char*)block;
             slen = strlen(str) + 1;
-            buf = (char*)buf + slen;
+            block += slen;
 
             if(entryTid < tid) continue;
             if(entryTid > tid) break;
@@ -538,49 +1201,233 @@ bbOverlappingEntries_t *bbGetOverlappingEntriesCore(bigWigFile_t *fp, bwOverlapB
             if(start >= oend) break;
 
             //Push the overlap
-            if(!pushBBIntervals(output, start, end, str, withString)) goto error;
+            if(!(output = pushBBIntervals(output, start, end, str, withString))) goto error;
         }
-
-        buf = (char*)bufEnd - tmp; //reset the buffer pointer
     }
 
     if(compressed && buf) free(buf);
-    if(compBuf) free(compBuf);
+    bwFreeBlockBuffer(&compBuf);
     return output;
 
 error:
-    fprintf(stderr, "[bbGetOverlappingEntriesCore] Got an error\n");
-    buf = (char*)bufEnd - tmp;
     if(output) bbDestroyOverlappingEntries(output);
     if(compressed && buf) free(buf);
-    if(compBuf) free(compBuf);
+    bwFreeBlockBuffer(&compBuf);
     return NULL;
 }
 
+/// @cond SKIP
+//A query whose blocks are split into chunks that are decoded concurrently
+struct blockChunks_t {
+    bigWigFile_t *fp;
+    const bwOverlapBlock_t *o;
+    uint32_t tid, start, end;
+    int withString;
+    uint64_t n; //The number of chunks
+    void **output; //The decoded intervals or entries of each chunk, NULL on error
+    float *values; //For bwGetValuesInto(), where every chunk writes its values
+};
+/// @endcond
+
+//The number of chunks to split the blocks of a query into, or 0 if they should be decoded by the calling thread alone
+static uint64_t nBlockChunks(bigWigFile_t *fp, const bwOverlapBlock_t *o) {
+    uint64_t n = bwGetThreads();
+    if(n < 2 || o->n < BW_PARALLEL_MIN_BLOCKS) return 0;
+    //The read function of a caller-supplied backend needn't be thread-safe
+    if(fp->URL->type == BWG_BACKEND) return 0;
+    //A few chunks per thread keeps them all busy when some blocks take longer to fetch or decode
+    n *= 4;
+    return (n < o->n)?n:o->n;
+}
+
+//The blocks in chunk i, which remain in file order so that bwReadBlock() doesn't read past the end of the chunk
+static bwOverlapBlock_t chunkBlocks(const struct blockChunks_t *c, uint64_t i) {
+    uint64_t first = c->o->n * i / c->n, last = c->o->n * (i+1) / c->n;
+    bwOverlapBlock_t chunk = {last - first, c->o->offset + first, c->o->size + first};
+    return chunk;
+}
+
+static void intervalsChunk(void *arg, uint64_t i) {
+    struct blockChunks_t *c = arg;
+    bwOverlapBlock_t chunk = chunkBlocks(c, i);
+    c->output[i] = intervalsFromBlocks(c->fp, &chunk, c->tid, c->start, c->end);
+}
+
+static void entriesChunk(void *arg, uint64_t i) {
+    struct blockChunks_t *c = arg;
+    bwOverlapBlock_t chunk = chunkBlocks(c, i);
+    c->output[i] = entriesFromBlocks(c->fp, &chunk, c->tid, c->start, c->end, c->withString);
+}
+
+//Since the values are written in place, output is only used to report success
+static void valuesChunk(void *arg, uint64_t i) {
+    struct blockChunks_t *c = arg;
+    bwOverlapBlock_t chunk = chunkBlocks(c, i);
+    c->output[i] = valuesFromBlocks(c->fp, &chunk, c->tid, c->start, c->end, c->values) ? NULL : c->values;
+}
+
+//Decode the chunks concurrently, returning 1 on error
+static int decodeChunks(struct blockChunks_t *c, void (*func)(void*, uint64_t)) {
+    uint64_t i;
+    c->output = calloc(c->n, sizeof(void*));
+    if(!c->output) return 1;
+    bwParallelFor(c->n, func, c);
+    for(i=0; i<c->n; i++) {
+        if(!c->output[i]) return 1;
+    }
+    return 0;
+}
+
+//Concatenate the intervals of each chunk in order, destroying them
+//Returns NULL on error
+static bwOverlappingIntervals_t *joinIntervals(struct blockChunks_t *c) {
+    uint64_t i;
+    uint32_t l = 0;
+    bwOverlappingIntervals_t *chunk, *output = calloc(1, sizeof(bwOverlappingIntervals_t));
+    if(!output) return NULL;
+
+    for(i=0; i<c->n; i++) output->m += ((bwOverlappingIntervals_t*) c->output[i])->l;
+    if(output->m) {
+        output->start = malloc(output->m * sizeof(uint32_t));
+        output->end = malloc(output->m * sizeof(uint32_t));
+        output->value = malloc(output->m * sizeof(float));
+        if(!output->start || !output->end || !output->value) {
+            bwDestroyOverlappingIntervals(output);
+            return NULL;
+        }
+    }
+
+    for(i=0; i<c->n; i++) {
+        chunk = c->output[i];
+        if(chunk->l) {
+            memcpy(output->start + l, chunk->start, chunk->l * sizeof(uint32_t));
+            memcpy(output->end + l, chunk->end, chunk->l * sizeof(uint32_t));
+            memcpy(output->value + l, chunk->value, chunk->l * sizeof(float));
+            l += chunk->l;
+        }
+        bwDestroyOverlappingIntervals(chunk);
+        c->output[i] = NULL;
+    }
+    output->l = l;
+    return output;
+}
+
+//Like joinIntervals(), but the strings are moved rather than copied
+static bbOverlappingEntries_t *joinEntries(struct blockChunks_t *c) {
+    uint64_t i;
+    uint32_t l = 0;
+    bbOverlappingEntries_t *chunk, *output = calloc(1, sizeof(bbOverlappingEntries_t));
+    if(!output) return NULL;
+
+    for(i=0; i<c->n; i++) output->m += ((bbOverlappingEntries_t*) c->output[i])->l;
+    if(output->m) {
+        output->start = malloc(output->m * sizeof(uint32_t));
+        output->end = malloc(output->m * sizeof(uint32_t));
+        if(c->withString) output->str = calloc(output->m, sizeof(char*));
+        if(!output->start || !output->end || (c->withString && !output->str)) {
+            bbDestroyOverlappingEntries(output);
+            return NULL;
+        }
+    }
+
+    for(i=0; i<c->n; i++) {
+        chunk = c->output[i];
+        if(chunk->l) {
+            memcpy(output->start + l, chunk->start, chunk->l * sizeof(uint32_t));
+            memcpy(output->end + l, chunk->end, chunk->l * sizeof(uint32_t));
+            if(c->withString) {
+                memcpy(output->str + l, chunk->str, chunk->l * sizeof(char*));
+                free(chunk->str);
+                chunk->str = NULL;
+            }
+            l += chunk->l;
+        }
+        bbDestroyOverlappingEntries(chunk);
+        c->output[i] = NULL;
+    }
+    output->l = l;
+    return output;
+}
+
+//Returns NULL on error
+bwOverlappingIntervals_t *bwGetOverlappingIntervalsCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend) {
+    struct blockChunks_t c = {fp, o, tid, ostart, oend, 0, 0, NULL, NULL};
+    bwOverlappingIntervals_t *output = NULL;
+    uint64_t i;
+
+    if(!o || !o->n) return calloc(1, sizeof(bwOverlappingIntervals_t));
+
+    c.n = nBlockChunks(fp, o);
+    if(!c.n) {
+        output = intervalsFromBlocks(fp, o, tid, ostart, oend);
+    } else if(!decodeChunks(&c, intervalsChunk)) {
+        output = joinIntervals(&c);
+    }
+
+    if(c.output) {
+        for(i=0; i<c.n; i++) bwDestroyOverlappingIntervals(c.output[i]);
+        free(c.output);
+    }
+    if(!output) fprintf(stderr, "[bwGetOverlappingIntervalsCore] Got an error\n");
+    return output;
+}
+
+bbOverlappingEntries_t *bbGetOverlappingEntriesCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend, int withString) {
+    struct blockChunks_t c = {fp, o, tid, ostart, oend, withString, 0, NULL, NULL};
+    bbOverlappingEntries_t *output = NULL;
+    uint64_t i;
+
+    if(!o || !o->n) return calloc(1, sizeof(bbOverlappingEntries_t));
+
+    c.n = nBlockChunks(fp, o);
+    if(!c.n) {
+        output = entriesFromBlocks(fp, o, tid, ostart, oend, withString);
+    } else if(!decodeChunks(&c, entriesChunk)) {
+        output = joinEntries(&c);
+    }
+
+    if(c.output) {
+        for(i=0; i<c.n; i++) bbDestroyOverlappingEntries(c.output[i]);
+        free(c.output);
+    }
+    if(!output) fprintf(stderr, "[bbGetOverlappingEntriesCore] Got an error\n");
+    return output;
+}
+
 //Returns NULL on error OR no intervals, which is a bad design...
-bwOverlappingIntervals_t *bwGetOverlappingIntervals(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end) {
+bwOverlappingIntervals_t *bwGetOverlappingIntervalsTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end) {
     bwOverlappingIntervals_t *output;
-    uint32_t tid = bwGetTid(fp, chrom);
-    if(tid == (uint32_t) -1) return NULL;
-    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, chrom, start, end);
+    if(tid >= fp->cl->nKeys) return NULL;
+    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, tid, start, end);
     if(!blocks) return NULL;
     output = bwGetOverlappingIntervalsCore(fp, blocks, tid, start, end);
     destroyBWOverlapBlock(blocks);
     return output;
 }
 
-//Like above, but for bigBed files
-bbOverlappingEntries_t *bbGetOverlappingEntries(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, int withString) {
-    bbOverlappingEntries_t *output;
+bwOverlappingIntervals_t *bwGetOverlappingIntervals(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end) {
     uint32_t tid = bwGetTid(fp, chrom);
     if(tid == (uint32_t) -1) return NULL;
-    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, chrom, start, end);
+    return bwGetOverlappingIntervalsTid(fp, tid, start, end);
+}
+
+//Like above, but for bigBed files
+bbOverlappingEntries_t *bbGetOverlappingEntriesTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, int withString) {
+    bbOverlappingEntries_t *output;
+    if(tid >= fp->cl->nKeys) return NULL;
+    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, tid, start, end);
     if(!blocks) return NULL;
     output = bbGetOverlappingEntriesCore(fp, blocks, tid, start, end, withString);
     destroyBWOverlapBlock(blocks);
     return output;
 }
 
+bbOverlappingEntries_t *bbGetOverlappingEntries(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, int withString) {
+    uint32_t tid = bwGetTid(fp, chrom);
+    if(tid == (uint32_t) -1) return NULL;
+    return bbGetOverlappingEntriesTid(fp, tid, start, end, withString);
+}
+
 //Returns NULL on error
 bwOverlapIterator_t *bwOverlappingIntervalsIterator(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t blocksPerIteration) {
     bwOverlapIterator_t *output = NULL;
@@ -589,7 +1436,7 @@ bwOverlapIterator_t *bwOverlappingIntervalsIterator(bigWigFile_t *fp, const char
     if(tid == (uint32_t) -1) return output;
     output = calloc(1, sizeof(bwOverlapIterator_t));
     if(!output) return output;
-    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, chrom, start, end);
+    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, tid, start, end);
 
     output->bw = fp;
     output->tid = tid;
@@ -617,7 +1464,7 @@ bwOverlapIterator_t *bbOverlappingEntriesIterator(bigWigFile_t *fp, const char *
     if(tid == (uint32_t) -1) return output;
     output = calloc(1, sizeof(bwOverlapIterator_t));
     if(!output) return output;
-    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, chrom, start, end);
+    bwOverlapBlock_t *blocks = bwGetOverlappingBlocks(fp, tid, start, end);
 
     output->bw = fp;
     output->tid = tid;
@@ -709,10 +1556,15 @@ error:
 //If includeNA is not 0 then ->start is also NULL, since it's implied
 //Note that bwDestroyOverlappingIntervals() will work in either case
 bwOverlappingIntervals_t *bwGetValues(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, int includeNA) {
+    uint32_t tid = bwGetTid(fp, chrom);
+    if(tid == (uint32_t) -1) return NULL;
+    return bwGetValuesTid(fp, tid, start, end, includeNA);
+}
+
+bwOverlappingIntervals_t *bwGetValuesTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, int includeNA) {
     uint32_t i, j, n;
     bwOverlappingIntervals_t *output = NULL;
-    bwOverlappingIntervals_t *intermediate = bwGetOverlappingIntervals(fp, chrom, start, end);
-    if(!intermediate) return NULL;
+    bwOverlappingIntervals_t *intermediate = NULL;
 
     output = calloc(1, sizeof(bwOverlappingIntervals_t));
     if(!output) goto error;
@@ -720,32 +1572,29 @@ bwOverlappingIntervals_t *bwGetValues(bigWigFile_t *fp, const char *chrom, uint3
         output->l = end-start;
         output->value = malloc(output->l*sizeof(float));
         if(!output->value) goto error;
-        for(i=0; i<output->l; i++) output->value[i] = NAN;
-        for(i=0; i<intermediate->l; i++) {
-            for(j=intermediate->start[i]; j<intermediate->end[i]; j++) {
-                if(j < start || j >= end) continue;
-                output->value[j-start] = intermediate->value[i];
-            }
-        }
-    } else {
-        n = 0;
-        for(i=0; i<intermediate->l; i++) {
-            if(intermediate->start[i] < start) intermediate->start[i] = start;
-            if(intermediate->end[i] > end) intermediate->end[i] = end;
-            n += intermediate->end[i]-intermediate->start[i];
-        }
-        output->l = n;
-        output->start = malloc(sizeof(uint32_t)*n);
-        if(!output->start) goto error;
-        output->value = malloc(sizeof(float)*n);
-        if(!output->value) goto error;
-        n = 0; //this is now the index
-        for(i=0; i<intermediate->l; i++) {
-            for(j=intermediate->start[i]; j<intermediate->end[i]; j++) {
-                if(j < start || j >= end) continue;
-                output->start[n] = j;
-                output->value[n++] = intermediate->value[i];
-            }
+        if(bwGetValuesIntoTid(fp, tid, start, end, output->value)) goto error;
+        return output;
+    }
+
+    intermediate = bwGetOverlappingIntervalsTid(fp, tid, start, end);
+    if(!intermediate) goto error;
+    n = 0;
+    for(i=0; i<intermediate->l; i++) {
+        if(intermediate->start[i] < start) intermediate->start[i] = start;
+        if(intermediate->end[i] > end) intermediate->end[i] = end;
+        n += intermediate->end[i]-intermediate->start[i];
+    }
+    output->l = n;
+    output->start = malloc(sizeof(uint32_t)*n);
+    if(!output->start) goto error;
+    output->value = malloc(sizeof(float)*n);
+    if(!output->value) goto error;
+    n = 0; //this is now the index
+    for(i=0; i<intermediate->l; i++) {
+        for(j=intermediate->start[i]; j<intermediate->end[i]; j++) {
+            if(j < start || j >= end) continue;
+            output->start[n] = j;
+            output->value[n++] = intermediate->value[i];
         }
     }
 
@@ -758,6 +1607,60 @@ error:
     return NULL;
 }
 
+int bwGetValuesInto(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, float *out) {
+    uint32_t tid = bwGetTid(fp, chrom);
+    if(tid == (uint32_t) -1) return 1;
+    return bwGetValuesIntoTid(fp, tid, start, end, out);
+}
+
+int bwGetValuesIntoTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, float *out) {
+    struct blockChunks_t c = {fp, NULL, tid, start, end, 0, 0, NULL, out};
+    bwOverlapBlock_t *blocks;
+    uint32_t i;
+    int rv;
+
+    if(tid >= fp->cl->nKeys || end < start) return 1;
+    for(i=0; i<end-start; i++) out[i] = NAN;
+
+    blocks = bwGetOverlappingBlocks(fp, tid, start, end);
+    if(!blocks) return 1;
+    c.o = blocks;
+    c.n = nBlockChunks(fp, blocks);
+    if(!c.n) rv = valuesFromBlocks(fp, blocks, tid, start, end, out);
+    else rv = decodeChunks(&c, valuesChunk);
+
+    free(c.output);
+    destroyBWOverlapBlock(blocks);
+    return rv;
+}
+
+bwOverlappingIntervals_t *bwGetValueRuns(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end) {
+    uint32_t tid = bwGetTid(fp, chrom);
+    if(tid == (uint32_t) -1) return NULL;
+    return bwGetValueRunsTid(fp, tid, start, end);
+}
+
+//The intervals are clipped and merged in place
+bwOverlappingIntervals_t *bwGetValueRunsTid(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end) {
+    uint32_t i, n = 0;
+    bwOverlappingIntervals_t *o = bwGetOverlappingIntervalsTid(fp, tid, start, end);
+    if(!o) return NULL;
+
+    for(i=0; i<o->l; i++) {
+        if(o->start[i] < start) o->start[i] = start;
+        if(o->end[i] > end) o->end[i] = end;
+        if(n && o->start[i] == o->end[n-1] && o->value[i] == o->value[n-1]) {
+            o->end[n-1] = o->end[i];
+            continue;
+        }
+        o->start[n] = o->start[i];
+        o->end[n] = o->end[i];
+        o->value[n++] = o->value[i];
+    }
+    o->l = n;
+    return o;
+}
+
 void bwDestroyIndexNode(bwRTreeNode_t *node) {
     uint16_t i;
 
@@ -781,6 +1684,7 @@ void bwDestroyIndexNode(bwRTreeNode_t *node) {
 
 void bwDestroyIndex(bwRTree_t *idx) {
     bwDestroyIndexNode(idx->root);
+    destroyFlatIndex(idx->flat);
     free(idx);
 }
 
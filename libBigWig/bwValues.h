@@ -32,6 +32,20 @@ typedef struct bwRTreeNode_t {
     } x; /**<A union holding either size or child*/
 } bwRTreeNode_t;
 
+/*!
+ * @brief All of the leaves of an R-tree, flattened into arrays sorted by position. See bwFlattenIndex().
+ *
+ * Positions are packed as (chromosome index << 32) | base, so they can be compared directly.
+ */
+typedef struct {
+    uint64_t n; /**<The number of data blocks.*/
+    uint64_t *start; /**<The packed start position of each block.*/
+    uint64_t *end; /**<The packed end position of each block.*/
+    uint64_t *maxEnd; /**<The largest end of this and all previous blocks. Unlike end, this is sorted even if blocks overlap.*/
+    uint64_t *offset; /**<The offset to the on-disk position of each block.*/
+    uint64_t *size; /**<The size of each block on disk (in bytes).*/
+} bwFlatIndex_t;
+
 /*!
  * A header and index that points to an R-tree that in turn points to data blocks.
  */
@@ -48,6 +62,7 @@ typedef struct {
     //There's 4 bytes of padding in the file here
     uint64_t rootOffset; /**<The offset to the root node of the R-Tree (on disk). Yes, this is redundant.*/
     bwRTreeNode_t *root; /**<A pointer to the root node.*/
+    bwFlatIndex_t *flat; /**<If not NULL, the leaves of the whole tree, which are then used instead of root.*/
 } bwRTree_t;
 
 /*!
@@ -35,6 +35,7 @@ chromList_t *bwCreateChromList(const char* const* chroms, const uint32_t *length
         cl->chrom[i] = bwStrdup(chroms[i]);
         if(!cl->chrom[i]) goto error;
     }
+    if(bwBuildChromHash(cl)) goto error;
 
     return cl;
 
@@ -44,6 +45,7 @@ error:
         for(j=0; j<i; j++) free(cl->chrom[j]);
     }
     if(cl) {
+        free(cl->hash);
         if(cl->chrom) free(cl->chrom);
         if(cl->len) free(cl->len);
         free(cl);
@@ -70,6 +72,7 @@ int bwCreateHdr(bigWigFile_t *fp, int32_t maxZooms) {
     hdr->maxVal = DBL_MIN;
     fp->hdr = hdr;
     fp->writeBuffer->blockSize = 64;
+    fp->writeBuffer->chromBlockSize = 256;
 
     //Allocate the writeBuffer buffers
     fp->writeBuffer->compressPsz = compressBound(hdr->bufSize);
@@ -90,96 +93,107 @@ static int writeAtPos(void *ptr, size_t sz, size_t nmemb, size_t pos, FILE *fp)
     return 0;
 }
 
-//We lose keySize bytes on error
-static int writeChromList(FILE *fp, chromList_t *cl) {
-    uint16_t k;
-    uint32_t j, magic = CIRTREE_MAGIC;
-    uint32_t nperblock = (cl->nKeys > 0x7FFF) ? 0x7FFF : cl->nKeys; //Items per leaf/non-leaf, there are no unsigned ints in java :(
-    uint32_t nblocks, keySize = 0, valSize = 8; //In theory valSize could be optimized, in practice that'd be annoying
-    uint64_t i, nonLeafEnd, leafSize, nextLeaf;
-    uint8_t eight;
-    int64_t i64;
-    char *chrom;
+/// @cond SKIP
+struct chromKey_t {
+    const char *chrom;
+    uint32_t tid;
+};
+/// @endcond
+
+static int cmpChromKeys(const void *a, const void *b) {
+    return strcmp(((const struct chromKey_t*) a)->chrom, ((const struct chromKey_t*) b)->chrom);
+}
+
+//Write a B+ tree of the chromosome names, sorted so that readers can binary search it
+//Every node holds up to blockSize items, as does the root (so a small list is just one leaf)
+static int writeChromList(FILE *fp, chromList_t *cl, uint32_t blockSize) {
+    uint16_t count;
+    uint32_t magic = CIRTREE_MAGIC, keySize = 0, valSize = 8, level, nLevels = 1; //In theory valSize could be optimized, in practice that'd be annoying
+    uint64_t i, j, n, nNodes, slotSize, nodeSize, nextChild, indexSize, leafSize;
+    uint8_t hdr[4] = {0, 0, 0, 0};
+    struct chromKey_t *keys = NULL;
+    char *chrom = NULL;
     size_t l;
+    int rv = 1;
 
-    if(cl->nKeys > 1073676289) {
-        fprintf(stderr, "[writeChromList] Error: Currently only 1,073,676,289 contigs are supported. If you really need more then please post a request on github.\n");
+    if(cl->nKeys >= (uint32_t) -1) {
+        fprintf(stderr, "[writeChromList] Error: At most 4,294,967,294 contigs are supported.\n");
         return 1;
     }
-    nblocks = cl->nKeys/nperblock;
-    nblocks += ((cl->nKeys % nperblock) > 0)?1:0;
-
-    for(i64=0; i64<cl->nKeys; i64++) {
-        l = strlen(cl->chrom[i64]);
+    if(blockSize < 2) blockSize = 2;
+    if(blockSize > 0xFFFF) blockSize = 0xFFFF;
+    if(cl->nKeys < blockSize) blockSize = (cl->nKeys) ? cl->nKeys : 1;
+    for(n=blockSize; n<(uint64_t) cl->nKeys; n*=blockSize) nLevels++;
+
+    keys = malloc(sizeof(struct chromKey_t) * (cl->nKeys + 1));
+    if(!keys) return 2;
+    for(i=0; i<(uint64_t) cl->nKeys; i++) {
+        keys[i].chrom = cl->chrom[i];
+        keys[i].tid = i;
+        l = strlen(cl->chrom[i]);
         if(l>keySize) keySize = l;
     }
-    l--; //We don't null terminate strings, because schiess mich tot
-    chrom = calloc(keySize, sizeof(char));
-
-    //Write the root node of a largely pointless tree
-    if(fwrite(&magic, sizeof(uint32_t), 1, fp) != 1) return 1;
-    if(fwrite(&nperblock, sizeof(uint32_t), 1, fp) != 1) return 2;
-    if(fwrite(&keySize, sizeof(uint32_t), 1, fp) != 1) return 3;
-    if(fwrite(&valSize, sizeof(uint32_t), 1, fp) != 1) return 4;
-    if(fwrite(&(cl->nKeys), sizeof(uint64_t), 1, fp) != 1) return 5;
-
+    qsort(keys, cl->nKeys, sizeof(struct chromKey_t), cmpChromKeys);
+    //We don't null terminate strings, because schiess mich tot
+    chrom = calloc(keySize + 8, sizeof(char));
+    if(!chrom) goto error;
+
+    if(fwrite(&magic, sizeof(uint32_t), 1, fp) != 1) goto error;
+    if(fwrite(&blockSize, sizeof(uint32_t), 1, fp) != 1) goto error;
+    if(fwrite(&keySize, sizeof(uint32_t), 1, fp) != 1) goto error;
+    if(fwrite(&valSize, sizeof(uint32_t), 1, fp) != 1) goto error;
+    if(fwrite(&(cl->nKeys), sizeof(uint64_t), 1, fp) != 1) goto error;
     //Padding?
     i=0;
-    if(fwrite(&i, sizeof(uint64_t), 1, fp) != 1) return 6;
-
-    //Do we need a non-leaf node?
-    if(nblocks > 1) {
-        eight = 0;
-        if(fwrite(&eight, sizeof(uint8_t), 1, fp) != 1) return 7;
-        if(fwrite(&eight, sizeof(uint8_t), 1, fp) != 1) return 8; //padding
-        if(fwrite(&nblocks, sizeof(uint16_t), 1, fp) != 1) return 8;
-        nonLeafEnd = ftell(fp) + nperblock * (keySize + 8);
-        leafSize = nperblock * (keySize + 8) + 4;
-        for(i=0; i<nblocks; i++) { //Why yes, this is pointless
-            chrom = strncpy(chrom, cl->chrom[i * nperblock], keySize);
-            nextLeaf = nonLeafEnd + i * leafSize;
-            if(fwrite(chrom, keySize, 1, fp) != 1) return 9;
-            if(fwrite(&nextLeaf, sizeof(uint64_t), 1, fp) != 1) return 10;
-        }
-        for(i=0; i<keySize; i++) chrom[i] = '\0';
-        nextLeaf = 0;
-        for(i=nblocks; i<nperblock; i++) {
-            if(fwrite(chrom, keySize, 1, fp) != 1) return 9;
-            if(fwrite(&nextLeaf, sizeof(uint64_t), 1, fp) != 1) return 10;
+    if(fwrite(&i, sizeof(uint64_t), 1, fp) != 1) goto error;
+
+    //The non-leaf levels, starting at the root. Each item points to a node of the next level.
+    indexSize = 4 + blockSize * (keySize + 8);
+    leafSize = 4 + blockSize * (keySize + valSize);
+    for(level=nLevels-1; level>0; level--) {
+        for(i=1, slotSize=1; i<=level; i++) slotSize *= blockSize;
+        nodeSize = slotSize * blockSize;
+        nNodes = (cl->nKeys + nodeSize - 1) / nodeSize;
+        nextChild = ftell(fp) + nNodes * indexSize;
+        for(i=0; i<(uint64_t) cl->nKeys; i+=nodeSize) {
+            n = (cl->nKeys - i + slotSize - 1) / slotSize;
+            count = (n > blockSize) ? blockSize : n;
+            memcpy(hdr + 2, &count, sizeof(uint16_t));
+            if(fwrite(hdr, sizeof(uint8_t), 4, fp) != 4) goto error;
+            for(j=0; j<blockSize; j++) {
+                memset(chrom, 0, keySize + 8);
+                if(j < count) {
+                    strncpy(chrom, keys[i + j * slotSize].chrom, keySize);
+                    memcpy(chrom + keySize, &nextChild, sizeof(uint64_t));
+                    nextChild += (level == 1) ? leafSize : indexSize;
+                }
+                if(fwrite(chrom, keySize + 8, 1, fp) != 1) goto error;
+            }
         }
     }
 
     //Write the leaves
-    nextLeaf = 0;
-    for(i=0, j=0; i<nblocks; i++) {
-        eight = 1;
-        if(fwrite(&eight, sizeof(uint8_t), 1, fp) != 1) return 11;
-        eight = 0;
-        if(fwrite(&eight, sizeof(uint8_t), 1, fp) != 1) return 12;
-        if(cl->nKeys - j < nperblock) {
-            k = cl->nKeys - j;
-            if(fwrite(&k, sizeof(uint16_t), 1, fp) != 1) return 13;
-        } else {
-            if(fwrite(&nperblock, sizeof(uint16_t), 1, fp) != 1) return 13;
-        }
-        for(k=0; k<nperblock; k++) {
-            if(j>=cl->nKeys) {
-                if(chrom[0]) {
-                    for(l=0; l<keySize; l++) chrom[l] = '\0';
-                }
-                if(fwrite(chrom, keySize, 1, fp) != 1) return 15;
-                if(fwrite(&nextLeaf, sizeof(uint64_t), 1, fp) != 1) return 16;
-            } else {
-                chrom = strncpy(chrom, cl->chrom[j], keySize);
-                if(fwrite(chrom, keySize, 1, fp) != 1) return 15;
-                if(fwrite(&j, sizeof(uint32_t), 1, fp) != 1) return 16;
-                if(fwrite(&(cl->len[j++]), sizeof(uint32_t), 1, fp) != 1) return 17;
+    hdr[0] = 1;
+    for(i=0; i<(uint64_t) cl->nKeys || i==0; i+=blockSize) {
+        count = (cl->nKeys - i < blockSize) ? cl->nKeys - i : blockSize;
+        memcpy(hdr + 2, &count, sizeof(uint16_t));
+        if(fwrite(hdr, sizeof(uint8_t), 4, fp) != 4) goto error;
+        for(j=0; j<blockSize; j++) {
+            memset(chrom, 0, keySize + 8);
+            if(j < count) {
+                strncpy(chrom, keys[i + j].chrom, keySize);
+                memcpy(chrom + keySize, &(keys[i + j].tid), sizeof(uint32_t));
+                memcpy(chrom + keySize + 4, &(cl->len[keys[i + j].tid]), sizeof(uint32_t));
             }
+            if(fwrite(chrom, keySize + valSize, 1, fp) != 1) goto error;
         }
     }
+    rv = 0;
 
+error:
     free(chrom);
-    return 0;
+    free(keys);
+    return rv;
 }
 
 //returns 0 on success
@@ -214,7 +228,7 @@ int bwWriteHdr(bigWigFile_t *bw) {
 
     //Write the chromosome list as a stupid freaking tree (because let's TREE ALL THE THINGS!!!)
     bw->hdr->ctOffset = ftell(fp);
-    if(writeChromList(fp, bw->cl)) return 7;
+    if(writeChromList(fp, bw->cl, bw->writeBuffer->chromBlockSize)) return 7;
     if(writeAtPos(&(bw->hdr->ctOffset), sizeof(uint64_t), 1, 0x8, fp)) return 8;
 
     //Update the dataOffset
@@ -311,7 +325,7 @@ error:
  */
 static int flushBuffer(bigWigFile_t *fp) {
     bwWriteBuffer_t *wb = fp->writeBuffer;
-    uLongf sz = wb->compressPsz;
+    size_t sz = wb->compressPsz;
     uint16_t nItems;
     if(!fp->writeBuffer->l) return 0;
     if(!wb->ltype) return 0;
@@ -342,7 +356,7 @@ static int flushBuffer(bigWigFile_t *fp) {
 
     if(sz) {
         //compress
-        if(compress(wb->compressP, &sz, wb->p, wb->l) != Z_OK) return 9;
+        if(bwDeflate(wb->compressP, &sz, wb->p, wb->l)) return 9;
 
         //write the data to disk
         if(fwrite(wb->compressP, sizeof(uint8_t), sz, fp->URL->x.fp) != sz) return 10;
@@ -737,7 +751,7 @@ int writeIndex(bigWigFile_t *fp) {
     bwRTreeNode_t *root = NULL;
 
     if(!fp->writeBuffer->nBlocks) return 0;
-    fp->idx = malloc(sizeof(bwRTree_t));
+    fp->idx = calloc(1, sizeof(bwRTree_t));
     if(!fp->idx) return 2;
     fp->idx->root = root;
 
@@ -1073,7 +1087,7 @@ int writeZoomLevels(bigWigFile_t *fp) {
     bwRTreeNode_t *root;
     bwZoomBuffer_t *zb, *zb2;
     bwWriteBuffer_t *wb = fp->writeBuffer;
-    uLongf sz;
+    size_t sz;
 
     for(i=0; i<fp->hdr->nLevels; i++) {
         if(i) {
@@ -1092,7 +1106,7 @@ int writeZoomLevels(bigWigFile_t *fp) {
         fp->writeBuffer->currentIndexNode = NULL;
         while(zb) {
             sz = fp->hdr->bufSize;
-            if(compress(wb->compressP, &sz, zb->p, zb->l) != Z_OK) return 2;
+            if(bwDeflate(wb->compressP, &sz, zb->p, zb->l)) return 2;
 
             //write the data to disk
             if(fwrite(wb->compressP, sizeof(uint8_t), sz, fp->URL->x.fp) != sz) return 3;
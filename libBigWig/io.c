@@ -5,13 +5,165 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <pthread.h>
 #include "bigWigIO.h"
 #include <inttypes.h>
 #include <errno.h>
+#include <time.h>
 
 size_t GLOBAL_DEFAULTBUFFERSIZE;
+int GLOBAL_REMOTEPARALLELISM = 8;
+size_t GLOBAL_REMOTECACHESIZE = 8388608;
+char *GLOBAL_CACHEDIR = NULL;
+
+//The magic number of the index of an on-disk cache
+#define CACHE_MAGIC 0x43574232
+//The offset of the reset ID within the index of an on-disk cache
+#define CACHE_RESETID_OFFSET 24
+//The size of the fixed part of the header of the index of an on-disk cache
+#define CACHE_HEADER_SIZE 32
 
 #ifndef NOCURL
+//The maximum number of idle connections kept for reuse by later urlOpen() calls
+#define MAX_IDLE_HANDLES 32
+
+/// @cond SKIP
+struct idleHandle_t {
+    char *host;
+    CURL *curl;
+};
+/// @endcond
+
+//DNS lookups, TLS sessions and connections are shared by all remote files, see urlInitShare()
+static CURLSH *GLOBAL_SHARE = NULL;
+static pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+//Handles of closed remote files, which can be reused for files on the same host
+static struct idleHandle_t idleHandles[MAX_IDLE_HANDLES];
+static int nIdleHandles = 0;
+static pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void urlShareLock(CURL *curl, curl_lock_data data, curl_lock_access access, void *p) {
+    (void) curl;
+    (void) access;
+    (void) p;
+    pthread_mutex_lock(&(shareLocks[data]));
+}
+
+static void urlShareUnlock(CURL *curl, curl_lock_data data, void *p) {
+    (void) curl;
+    (void) p;
+    pthread_mutex_unlock(&(shareLocks[data]));
+}
+
+int urlInitShare(void) {
+    int i;
+    if(GLOBAL_SHARE) return 0;
+    for(i=0; i<CURL_LOCK_DATA_LAST; i++) pthread_mutex_init(&(shareLocks[i]), NULL);
+    GLOBAL_SHARE = curl_share_init();
+    if(!GLOBAL_SHARE) goto error;
+    if(curl_share_setopt(GLOBAL_SHARE, CURLSHOPT_LOCKFUNC, urlShareLock) != CURLSHE_OK) goto error;
+    if(curl_share_setopt(GLOBAL_SHARE, CURLSHOPT_UNLOCKFUNC, urlShareUnlock) != CURLSHE_OK) goto error;
+    //Each type of data is shared if possible, e.g., TLS sessions can't be if curl was built without TLS
+    //Connections aren't shared, since curl doesn't support that between threads querying files at once. Closed files' handles are reused instead.
+    curl_share_setopt(GLOBAL_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(GLOBAL_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    return 0;
+
+error:
+    if(GLOBAL_SHARE) curl_share_cleanup(GLOBAL_SHARE);
+    GLOBAL_SHARE = NULL;
+    for(i=0; i<CURL_LOCK_DATA_LAST; i++) pthread_mutex_destroy(&(shareLocks[i]));
+    return 1;
+}
+
+void urlCleanupShare(void) {
+    int i;
+    pthread_mutex_lock(&idleLock);
+    for(i=0; i<nIdleHandles; i++) {
+        curl_easy_cleanup(idleHandles[i].curl);
+        free(idleHandles[i].host);
+    }
+    nIdleHandles = 0;
+    pthread_mutex_unlock(&idleLock);
+    if(!GLOBAL_SHARE) return;
+    //This fails if any remote files are still open, in which case the share is leaked rather than destroyed under them
+    if(curl_share_cleanup(GLOBAL_SHARE) != CURLSHE_OK) return;
+    GLOBAL_SHARE = NULL;
+    for(i=0; i<CURL_LOCK_DATA_LAST; i++) pthread_mutex_destroy(&(shareLocks[i]));
+}
+
+//The length of the scheme, credentials, host and port at the start of a URL
+static size_t urlHostLen(const char *fname) {
+    const char *p = strstr(fname, "://");
+    if(!p) return strlen(fname);
+    p += 3;
+    return p - fname + strcspn(p, "/?#");
+}
+
+//Get a handle for a new connection to fname, reusing an idle one for the same host if possible
+//All options of a reused handle are reset, but its connections and caches are kept
+static CURL *urlGetHandle(const char *fname) {
+    CURL *curl = NULL;
+    size_t len = urlHostLen(fname);
+    int i;
+
+    pthread_mutex_lock(&idleLock);
+    for(i=nIdleHandles-1; i>=0; i--) {
+        if(strlen(idleHandles[i].host) == len && strncmp(idleHandles[i].host, fname, len) == 0) {
+            curl = idleHandles[i].curl;
+            free(idleHandles[i].host);
+            idleHandles[i] = idleHandles[--nIdleHandles];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&idleLock);
+
+    if(curl) curl_easy_reset(curl);
+    else curl = curl_easy_init();
+    if(curl && GLOBAL_SHARE && curl_easy_setopt(curl, CURLOPT_SHARE, GLOBAL_SHARE) != CURLE_OK) {
+        curl_easy_cleanup(curl);
+        return NULL;
+    }
+    return curl;
+}
+
+//Keep the handle of a closed file for reuse by urlGetHandle(), the oldest idle handle is closed if there are too many
+static void urlReleaseHandle(const char *fname, CURL *curl) {
+    struct idleHandle_t old = {NULL, NULL};
+    char *host;
+    size_t len;
+
+    if(!curl) return;
+    len = urlHostLen(fname);
+    host = malloc(len + 1);
+    if(!host) {
+        curl_easy_cleanup(curl);
+        return;
+    }
+    memcpy(host, fname, len);
+    host[len] = '\0';
+
+    pthread_mutex_lock(&idleLock);
+    if(nIdleHandles == MAX_IDLE_HANDLES) {
+        old = idleHandles[0];
+        memmove(idleHandles, idleHandles + 1, (MAX_IDLE_HANDLES - 1) * sizeof(struct idleHandle_t));
+        nIdleHandles--;
+    }
+    idleHandles[nIdleHandles].host = host;
+    idleHandles[nIdleHandles++].curl = curl;
+    pthread_mutex_unlock(&idleLock);
+
+    if(old.curl) {
+        curl_easy_cleanup(old.curl);
+        free(old.host);
+    }
+}
+
 uint64_t getContentLength(const URL_t *URL) {
     double size;
     if(curl_easy_getinfo(URL->x.curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &size) != CURLE_OK) {
@@ -21,72 +173,549 @@ uint64_t getContentLength(const URL_t *URL) {
     return (uint64_t) size;
 }
 
-//Fill the buffer, note that URL may be left in an unusable state on error!
-CURLcode urlFetchData(URL_t *URL, unsigned long bufSize) {
-    CURLcode rv;
+/// @cond SKIP
+struct rangeBuf_t {
+    char *buf;
+    size_t size, len;
+    int slot;
+};
+/// @endcond
+
+//The curl write callback, storing a single range
+static size_t bwFillRange(const void *inBuf, size_t l, size_t nmemb, void *pRange) {
+    struct rangeBuf_t *r = (struct rangeBuf_t*) pRange;
+    if(l*nmemb > r->size - r->len) return 0; //More than requested, perhaps the server ignored the range
+    memcpy(r->buf + r->len, inBuf, l*nmemb);
+    r->len += l*nmemb;
+    return l*nmemb;
+}
+
+//Fetch a range into obuf with a single request on the main connection
+//Returns the number of bytes received, which is less than obufSize only at the end of the file, or 0 on error
+static size_t urlFetchRange(URL_t *URL, size_t pos, void *obuf, size_t obufSize) {
+    struct rangeBuf_t r = {obuf, obufSize, 0, 0};
     char range[1024];
+    CURLcode code;
+    long status = 0;
 
-    if(URL->filePos != (size_t) -1) URL->filePos += URL->bufLen;
-    else URL->filePos = 0;
+    sprintf(range,"%lu-%lu", pos, pos+obufSize-1);
+    code = curl_easy_setopt(URL->x.curl, CURLOPT_RANGE, range);
+    if(code == CURLE_OK) code = curl_easy_setopt(URL->x.curl, CURLOPT_WRITEDATA, (void*)&r);
+    if(code == CURLE_OK) code = curl_easy_perform(URL->x.curl);
+    errno = 0; //Sometimes curl_easy_perform leaves a random errno remnant
+    if(code != CURLE_OK) {
+        fprintf(stderr, "[urlFetchRange] Couldn't fetch %s: %s\n", range, curl_easy_strerror(code));
+        return 0;
+    }
+    //Don't mistake an error page for file contents
+    if(URL->type != BWG_FTP && curl_easy_getinfo(URL->x.curl, CURLINFO_RESPONSE_CODE, &status) == CURLE_OK && status >= 400) return 0;
+    return r.len;
+}
 
-    URL->bufPos = URL->bufLen = 0; //Otherwise, we can't copy anything into the buffer!
-    sprintf(range,"%lu-%lu", URL->filePos, URL->filePos+bufSize-1);
-    rv = curl_easy_setopt(URL->x.curl, CURLOPT_RANGE, range);
-    if(rv != CURLE_OK) {
-        fprintf(stderr, "[urlFetchData] Couldn't set the range (%s)\n", range);
-        return rv;
+static void urlUnlinkPage(URL_t *URL, urlPage_t *page) {
+    if(page->prev) page->prev->next = page->next;
+    else URL->pages = page->next;
+    if(page->next) page->next->prev = page->prev;
+    else URL->lastPage = page->prev;
+    URL->nPages--;
+}
+
+//Add a page as the most recently used
+static void urlPushPage(URL_t *URL, urlPage_t *page) {
+    page->prev = NULL;
+    page->next = URL->pages;
+    if(URL->pages) URL->pages->prev = page;
+    else URL->lastPage = page;
+    URL->pages = page;
+    URL->nPages++;
+}
+
+static void urlDestroyPages(URL_t *URL) {
+    urlPage_t *page;
+    while((page = URL->pages)) {
+        urlUnlinkPage(URL, page);
+        free(page);
     }
+}
 
-    rv = curl_easy_perform(URL->x.curl);
-    errno = 0; //Sometimes curl_easy_perform leaves a random errno remnant
+//The most recently used pages are first, so this is typically quick
+static urlPage_t *urlFindPage(URL_t *URL, size_t pos) {
+    urlPage_t *page;
+    for(page = URL->pages; page; page = page->next) {
+        if(page->pos == pos) return page;
+    }
+    return NULL;
+}
+
+//Like pread()/pwrite(), but retrying until everything is transferred. Returns 0 on success
+static int diskIO(int fd, void *buf, size_t len, size_t pos, int write) {
+    ssize_t n;
+    while(len) {
+        if(write) n = pwrite(fd, buf, len, pos);
+        else n = pread(fd, buf, len, pos);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        buf = (char*)buf + n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+/// @cond SKIP
+//The headers needed to tell whether a cached copy of a file is still valid
+struct urlValidator_t {
+    char etag[256];
+    char lastModified[256];
+    size_t length;
+};
+/// @endcond
+
+static void copyHeaderValue(char *dest, size_t destSize, const char *buf, size_t len) {
+    while(len && (*buf == ' ' || *buf == '\t')) {
+        buf++;
+        len--;
+    }
+    while(len && (buf[len-1] == '\r' || buf[len-1] == '\n' || buf[len-1] == ' ')) len--;
+    if(len >= destSize) len = destSize - 1;
+    memcpy(dest, buf, len);
+    dest[len] = '\0';
+}
+
+//A curl header callback, filling a urlValidator_t
+static size_t urlNoteHeader(char *buf, size_t l, size_t nmemb, void *pv) {
+    struct urlValidator_t *v = (struct urlValidator_t*) pv;
+    size_t len = l*nmemb;
+    char *p;
+
+    if(len >= 5 && strncasecmp(buf, "HTTP/", 5) == 0) { //A new response, e.g., after a redirect
+        memset(v, 0, sizeof(struct urlValidator_t));
+    } else if(len > 14 && strncasecmp(buf, "Content-Range:", 14) == 0) {
+        p = memchr(buf, '/', len);
+        if(p && p[1] >= '0' && p[1] <= '9') v->length = strtoull(p+1, NULL, 10);
+    } else if(len > 5 && strncasecmp(buf, "ETag:", 5) == 0) {
+        copyHeaderValue(v->etag, sizeof(v->etag), buf+5, len-5);
+    } else if(len > 14 && strncasecmp(buf, "Last-Modified:", 14) == 0) {
+        copyHeaderValue(v->lastModified, sizeof(v->lastModified), buf+14, len-14);
+    }
+    return len;
+}
+
+//flock(), retrying if interrupted. Returns 0 on success
+static int cacheLock(int fd, int op) {
+    int rv;
+    while((rv = flock(fd, op)) != 0 && errno == EINTR);
     return rv;
 }
 
-//Read data into a buffer, ideally from a buffer already in memory
-//The loop is likely no longer needed.
+//A new ID for a reset on-disk cache, which differs from those written by any other reset
+static uint64_t newResetId(void) {
+    static uint64_t counter = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^ ((uint64_t) getpid() << 40) ^ __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+}
+
+static void urlCloseDiskCache(URL_t *URL) {
+    if(!URL->onDisk) return;
+    free(URL->onDisk);
+    URL->onDisk = NULL;
+    close(URL->cacheFd);
+    close(URL->cacheIdxFd);
+}
+
+/*
+  Attach the on-disk cache for this URL, creating or resetting it as needed.
+  Files are named after a hash of the URL. The .bwc file holds cached pages at their original offsets, which
+  leaves the rest of it sparse. The .bwi file holds a header followed by one byte per page, which is non-zero
+  if the page is present:
+    uint32_t magic
+    uint32_t length of the validator
+    uint64_t page size
+    uint64_t file size
+    uint64_t reset ID, which is new every time the cache is reset
+    char validator[], the URL, ETag, Last-Modified and file size
+  Several processes may use the same files at once. Validating or resetting the cache and writing a page and its
+  flag are done holding an exclusive flock() on the .bwi file, and reading a page holds a shared one. Since another
+  process may reset the cache at any time, writes and reads also check that the reset ID is unchanged.
+  On any error the file is just not cached on disk.
+*/
+static void urlOpenDiskCache(URL_t *URL, const struct urlValidator_t *v) {
+    uint64_t hash = 14695981039346656037ULL, hdr64[3];
+    uint32_t hdr32[2];
+    size_t nDiskPages, i, vlen;
+    char *fname = NULL, *validator = NULL, *onDisk = NULL, *buf = NULL;
+    int fd = -1, idxFd = -1;
+
+    if(!GLOBAL_CACHEDIR || !v->length) return;
+
+    //FNV-1a
+    for(i=0; URL->fname[i]; i++) {
+        hash ^= (unsigned char) URL->fname[i];
+        hash *= 1099511628211ULL;
+    }
+
+    vlen = strlen(URL->fname) + strlen(v->etag) + strlen(v->lastModified) + 64;
+    validator = malloc(vlen);
+    fname = malloc(strlen(GLOBAL_CACHEDIR) + 32);
+    nDiskPages = (v->length + URL->bufSize - 1) / URL->bufSize;
+    onDisk = calloc(nDiskPages, 1);
+    buf = malloc(vlen + CACHE_HEADER_SIZE + nDiskPages);
+    if(!validator || !fname || !onDisk || !buf) goto error;
+    vlen = snprintf(validator, vlen, "%s\n%s\n%s\n%lu", URL->fname, v->etag, v->lastModified, (unsigned long) v->length);
+
+    if(mkdir(GLOBAL_CACHEDIR, 0755) != 0 && errno != EEXIST) goto error;
+    sprintf(fname, "%s/%016" PRIx64 ".bwc", GLOBAL_CACHEDIR, hash);
+    fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) goto error;
+    sprintf(fname, "%s/%016" PRIx64 ".bwi", GLOBAL_CACHEDIR, hash);
+    idxFd = open(fname, O_RDWR | O_CREAT, 0644);
+    if(idxFd < 0) goto error;
+    if(cacheLock(idxFd, LOCK_EX) != 0) goto error;
+
+    //Is there a valid cache already?
+    if(diskIO(idxFd, buf, vlen + CACHE_HEADER_SIZE + nDiskPages, 0, 0) == 0) {
+        memcpy(hdr32, buf, 8);
+        memcpy(hdr64, buf + 8, 24);
+        if(hdr32[0] == CACHE_MAGIC && hdr32[1] == vlen && hdr64[0] == URL->bufSize && hdr64[1] == v->length && memcmp(buf + CACHE_HEADER_SIZE, validator, vlen) == 0) {
+            memcpy(onDisk, buf + CACHE_HEADER_SIZE + vlen, nDiskPages);
+            goto done;
+        }
+    }
+
+    //No, so start a new one
+    hdr32[0] = CACHE_MAGIC;
+    hdr32[1] = vlen;
+    hdr64[0] = URL->bufSize;
+    hdr64[1] = v->length;
+    hdr64[2] = newResetId();
+    memcpy(buf, hdr32, 8);
+    memcpy(buf + 8, hdr64, 24);
+    memcpy(buf + CACHE_HEADER_SIZE, validator, vlen);
+    if(ftruncate(fd, 0) != 0 || ftruncate(idxFd, 0) != 0) goto error;
+    if(diskIO(idxFd, buf, vlen + CACHE_HEADER_SIZE, 0, 1) != 0) goto error;
+    if(ftruncate(idxFd, vlen + CACHE_HEADER_SIZE + nDiskPages) != 0) goto error;
+
+done:
+    flock(idxFd, LOCK_UN);
+    URL->onDisk = onDisk;
+    URL->nDiskPages = nDiskPages;
+    URL->fileLen = v->length;
+    URL->cacheFd = fd;
+    URL->cacheIdxFd = idxFd;
+    URL->cacheFlagOffset = vlen + CACHE_HEADER_SIZE;
+    URL->cacheResetId = hdr64[2];
+    free(validator);
+    free(fname);
+    free(buf);
+    errno = 0;
+    return;
+
+error:
+    fprintf(stderr, "[urlOpenDiskCache] Couldn't use the cache in %s for %s, continuing without it\n", GLOBAL_CACHEDIR, URL->fname);
+    if(fd >= 0) close(fd);
+    if(idxFd >= 0) close(idxFd); //This also releases the lock
+    free(validator);
+    free(fname);
+    free(onDisk);
+    free(buf);
+    errno = 0;
+}
+
+static int urlDiskHasPage(const URL_t *URL, size_t pos) {
+    if(!URL->onDisk || pos / URL->bufSize >= URL->nDiskPages) return 0;
+    return URL->onDisk[pos / URL->bufSize];
+}
+
+//The expected size of a page, which is smaller only at the end of the file
+static size_t urlPageLen(const URL_t *URL, size_t pos) {
+    if(!URL->fileLen || pos + URL->bufSize <= URL->fileLen) return URL->bufSize;
+    if(pos >= URL->fileLen) return 0;
+    return URL->fileLen - pos;
+}
+
+//Returns 1 if no other process has reset the on-disk cache since it was opened, which requires holding a lock on the index
+static int urlDiskCacheUnchanged(const URL_t *URL) {
+    uint64_t resetId;
+    if(diskIO(URL->cacheIdxFd, &resetId, sizeof(uint64_t), CACHE_RESETID_OFFSET, 0) != 0) return 0;
+    return resetId == URL->cacheResetId;
+}
+
+//Store a complete page, giving up on the on-disk cache after any error or if another process reset it
+static void urlDiskWritePage(URL_t *URL, size_t pos, const char *data, size_t len) {
+    char one = 1;
+    int rv;
+    if(!URL->onDisk || urlDiskHasPage(URL, pos) || len != urlPageLen(URL, pos) || !len) return;
+    if(cacheLock(URL->cacheIdxFd, LOCK_EX) != 0) goto error;
+    if(!urlDiskCacheUnchanged(URL)) {
+        flock(URL->cacheIdxFd, LOCK_UN);
+        urlCloseDiskCache(URL);
+        errno = 0;
+        return;
+    }
+    rv = diskIO(URL->cacheFd, (void*) data, len, pos, 1) == 0 && diskIO(URL->cacheIdxFd, &one, 1, URL->cacheFlagOffset + pos / URL->bufSize, 1) == 0;
+    flock(URL->cacheIdxFd, LOCK_UN);
+    if(rv) {
+        URL->onDisk[pos / URL->bufSize] = 1;
+        return;
+    }
+
+error:
+    fprintf(stderr, "[urlDiskWritePage] Couldn't write to the cache for %s, continuing without it\n", URL->fname);
+    urlCloseDiskCache(URL);
+    errno = 0;
+}
+
+//Read a page that's flagged as stored on disk. If another process has reset the cache in the meantime, it's no longer used.
+//Returns 0 on success
+static int urlDiskReadPage(URL_t *URL, size_t pos, char *data, size_t len) {
+    int rv = -1;
+    if(cacheLock(URL->cacheIdxFd, LOCK_SH) != 0) return -1;
+    if(urlDiskCacheUnchanged(URL)) rv = diskIO(URL->cacheFd, data, len, pos, 0);
+    flock(URL->cacheIdxFd, LOCK_UN);
+    if(rv != 0) urlCloseDiskCache(URL);
+    return rv;
+}
+
+//Evict the least recently used pages
+static void urlTrimPages(URL_t *URL) {
+    urlPage_t *page;
+    while(URL->nPages > URL->maxPages) {
+        page = URL->lastPage;
+        urlUnlinkPage(URL, page);
+        free(page);
+    }
+}
+
+//Return the page starting at pos, fetching it if it's not cached
+//Any directly following uncached pages, up to the one starting at lastPos, are fetched with the same request
+//Returns NULL on error
+static urlPage_t *urlGetPage(URL_t *URL, size_t pos, size_t lastPos) {
+    urlPage_t *page = urlFindPage(URL, pos), *newPage;
+    size_t n = 1, i, got;
+    char *buf;
+
+    if(page) {
+        if(page != URL->pages) {
+            urlUnlinkPage(URL, page);
+            urlPushPage(URL, page);
+        }
+        return page;
+    }
+
+    if(urlDiskHasPage(URL, pos)) {
+        page = malloc(sizeof(urlPage_t) + URL->bufSize);
+        if(!page) return NULL;
+        page->pos = pos;
+        page->len = urlPageLen(URL, pos);
+        page->data = (char*) (page + 1);
+        if(urlDiskReadPage(URL, pos, page->data, page->len) == 0) {
+            urlPushPage(URL, page);
+            urlTrimPages(URL);
+            return page;
+        }
+        free(page);
+        page = NULL;
+        errno = 0;
+    }
+
+    while(n < URL->maxPages && pos + n*URL->bufSize <= lastPos && !urlFindPage(URL, pos + n*URL->bufSize) && !urlDiskHasPage(URL, pos + n*URL->bufSize)) n++;
+    buf = malloc(n * URL->bufSize);
+    if(!buf) return NULL;
+    got = urlFetchRange(URL, pos, buf, n * URL->bufSize);
+
+    //Add the pages in reverse, so the requested one is the most recently used
+    for(i=n; i-- > 0;) {
+        if(got <= i * URL->bufSize) continue; //Past the end of the file
+        newPage = malloc(sizeof(urlPage_t) + URL->bufSize);
+        if(!newPage) break;
+        newPage->pos = pos + i * URL->bufSize;
+        newPage->len = got - i * URL->bufSize;
+        if(newPage->len > URL->bufSize) newPage->len = URL->bufSize;
+        newPage->data = (char*) (newPage + 1);
+        memcpy(newPage->data, buf + i * URL->bufSize, newPage->len);
+        urlDiskWritePage(URL, newPage->pos, newPage->data, newPage->len);
+        urlPushPage(URL, newPage);
+        page = newPage;
+    }
+    free(buf);
+    if(page && page->pos != pos) page = NULL;
+    urlTrimPages(URL);
+
+    return page;
+}
+
+//Copy bufSize bytes starting at pos into buf, using cached pages where possible
+//Returns the number of bytes copied, which is less than bufSize on error or at the end of the file
+static size_t urlReadPages(URL_t *URL, size_t pos, void *buf, size_t bufSize) {
+    size_t copied = 0, pagePos, lastPos, off, n;
+    urlPage_t *page;
+
+    if(!bufSize) return 0;
+    lastPos = pos + bufSize - 1;
+    lastPos -= lastPos % URL->bufSize;
+    while(copied < bufSize) {
+        pagePos = pos + copied;
+        pagePos -= pagePos % URL->bufSize;
+        page = urlGetPage(URL, pagePos, lastPos);
+        if(!page) break;
+
+        off = pos + copied - pagePos;
+        if(off >= page->len) break;
+        n = page->len - off;
+        if(n > bufSize - copied) n = bufSize - copied;
+        memcpy((char*)buf + copied, page->data + off, n);
+        copied += n;
+        if(page->len < URL->bufSize) break; //The end of the file
+    }
+    return copied;
+}
+
+//Read data into a buffer, starting at the current file position
 size_t url_fread(void *obuf, size_t obufSize, URL_t *URL) {
-    size_t remaining = obufSize, fetchSize;
-    void *p = obuf;
-    CURLcode rv;
-
-    while(remaining) {
-        if(!URL->bufLen) {
-            rv = urlFetchData(URL, URL->bufSize);
-            if(rv != CURLE_OK) {
-                fprintf(stderr, "[url_fread] urlFetchData (A) returned %s\n", curl_easy_strerror(rv));
-                return 0;
-            }  
-        } else if(URL->bufLen < URL->bufPos + remaining) { //Copy the remaining buffer and reload the buffer as needed
-            p = memcpy(p, URL->memBuf+URL->bufPos, URL->bufLen - URL->bufPos);
-            if(!p) return 0;
-            p += URL->bufLen - URL->bufPos;
-            remaining -= URL->bufLen - URL->bufPos;
-            if(remaining) {
-                if(!URL->isCompressed) {
-                    fetchSize = URL->bufSize;
-                } else {
-                    fetchSize = (remaining<URL->bufSize)?remaining:URL->bufSize;
-                }
-                rv = urlFetchData(URL, fetchSize);
-                if(rv != CURLE_OK) {
-                    fprintf(stderr, "[url_fread] urlFetchData (B) returned %s\n", curl_easy_strerror(rv));
-                    return 0;
-                }
+    size_t rv;
+
+    pthread_mutex_lock(&(URL->lock));
+    if(obufSize > URL->bufSize && !URL->onDisk) rv = urlFetchRange(URL, URL->filePos, obuf, obufSize);
+    else rv = urlReadPages(URL, URL->filePos, obuf, obufSize);
+    pthread_mutex_unlock(&(URL->lock));
+    URL->filePos += rv;
+    return rv;
+}
+
+//Create the multi handle and at least nConn connections for it
+//Returns 0 on success
+static int urlInitMulti(URL_t *URL, int nConn) {
+    CURL **easy;
+
+    if(!URL->multi) {
+        URL->multi = curl_multi_init();
+        if(!URL->multi) return -1;
+    }
+    if(nConn <= URL->nEasy) return 0;
+
+    easy = realloc(URL->easy, nConn * sizeof(CURL*));
+    if(!easy) return -1;
+    URL->easy = easy;
+    while(URL->nEasy < nConn) {
+        //This copies any options set by the user-supplied call back
+        easy[URL->nEasy] = curl_easy_duphandle(URL->x.curl);
+        if(!easy[URL->nEasy]) return -1;
+        URL->nEasy++;
+        if(curl_easy_setopt(easy[URL->nEasy-1], CURLOPT_WRITEFUNCTION, bwFillRange) != CURLE_OK) return -1;
+        if(GLOBAL_SHARE && curl_easy_setopt(easy[URL->nEasy-1], CURLOPT_SHARE, GLOBAL_SHARE) != CURLE_OK) return -1;
+    }
+    return 0;
+}
+
+//Start fetching a range on one of the connections
+//Returns 0 on success
+static int urlStartRange(URL_t *URL, int slot, size_t pos, struct rangeBuf_t *r) {
+    char range[1024];
+    CURL *curl = URL->easy[slot];
+
+    r->slot = slot;
+    r->len = 0;
+    sprintf(range,"%lu-%lu", pos, pos+r->size-1);
+    if(curl_easy_setopt(curl, CURLOPT_RANGE, range) != CURLE_OK) return -1;
+    if(curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)r) != CURLE_OK) return -1;
+    if(curl_easy_setopt(curl, CURLOPT_PRIVATE, (void*)r) != CURLE_OK) return -1;
+    if(curl_multi_add_handle(URL->multi, curl) != CURLM_OK) return -1;
+    return 0;
+}
+
+//Fetch n ranges concurrently, using up to GLOBAL_REMOTEPARALLELISM connections
+//Returns 0 on success
+static int urlFetchRanges(URL_t *URL, size_t n, const size_t *pos, const size_t *len, void *buf) {
+    struct rangeBuf_t *r = NULL, *done;
+    char *p = buf;
+    int nConn = GLOBAL_REMOTEPARALLELISM, slot, active = 0, still, nMsgs;
+    size_t i, next = 0;
+    CURLMsg *msg;
+    CURL *curl;
+    CURLcode code;
+
+    if((size_t) nConn > n) nConn = n;
+    if(urlInitMulti(URL, nConn)) {
+        fprintf(stderr, "[urlFetchRanges] Couldn't create the connections!\n");
+        return -1;
+    }
+
+    r = malloc(n * sizeof(struct rangeBuf_t));
+    if(!r) return -1;
+    for(i=0; i<n; i++) {
+        r[i].buf = p;
+        r[i].size = len[i];
+        p += len[i];
+    }
+
+    for(slot=0; slot<nConn; slot++) {
+        if(urlStartRange(URL, slot, pos[next], r + next)) goto error;
+        next++;
+        active++;
+    }
+
+    while(active) {
+        if(curl_multi_perform(URL->multi, &still) != CURLM_OK) goto error;
+        while((msg = curl_multi_info_read(URL->multi, &nMsgs))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            curl = msg->easy_handle;
+            code = msg->data.result;
+            if(curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**) &done) != CURLE_OK) goto error;
+            curl_multi_remove_handle(URL->multi, curl);
+            active--;
+            if(code != CURLE_OK) {
+                fprintf(stderr, "[urlFetchRanges] Got an error: %s\n", curl_easy_strerror(code));
+                goto error;
+            }
+            if(done->len != done->size) goto error;
+
+            //Reuse the connection for the next range
+            if(next < n) {
+                if(urlStartRange(URL, done->slot, pos[next], r + next)) goto error;
+                next++;
+                active++;
             }
-        } else {
-            p = memcpy(p, URL->memBuf+URL->bufPos, remaining);
-            if(!p) return 0;
-            URL->bufPos += remaining;
-            remaining = 0;
         }
+        if(active && curl_multi_wait(URL->multi, NULL, 0, 1000, NULL) != CURLM_OK) goto error;
     }
-    return obufSize;
+
+    errno = 0; //Sometimes curl leaves a random errno remnant
+    free(r);
+    return 0;
+
+error:
+    for(slot=0; slot<nConn; slot++) curl_multi_remove_handle(URL->multi, URL->easy[slot]);
+    errno = 0;
+    free(r);
+    return -1;
 }
 #endif
 
+//Copy from a memory-mapped file, returning 0 if there's not enough left
+static size_t mmap_fread(void *obuf, size_t obufSize, URL_t *URL) {
+    if(URL->bufPos > URL->bufLen || obufSize > URL->bufLen - URL->bufPos) return 0;
+    memcpy(obuf, (char*)URL->memBuf + URL->bufPos, obufSize);
+    URL->bufPos += obufSize;
+    return obufSize;
+}
+
+const void *urlReadPtr(URL_t *URL, size_t pos, size_t bufSize) {
+    if(URL->type != BWG_MMAP && URL->type != BWG_MEMORY) return NULL;
+    if(pos > URL->bufLen || bufSize > URL->bufLen - pos) return NULL;
+    return (char*)URL->memBuf + pos;
+}
+
 //Returns the number of bytes requested or a smaller number on error
 //Note that in the case of remote files, the actual amount read may be less than the return value!
 size_t urlRead(URL_t *URL, void *buf, size_t bufSize) {
+    size_t rv;
+    if(URL->type == BWG_MMAP || URL->type == BWG_MEMORY) return mmap_fread(buf, bufSize, URL);
+    if(URL->type == BWG_BACKEND) {
+        rv = urlReadAt(URL, URL->filePos, buf, bufSize);
+        URL->filePos += rv;
+        return rv;
+    }
 #ifndef NOCURL
     if(URL->type==0) {
         return fread(buf, bufSize, 1, URL->x.fp)*bufSize;
@@ -98,30 +727,20 @@ size_t urlRead(URL_t *URL, void *buf, size_t bufSize) {
 #endif
 }
 
-size_t bwFillBuffer(const void *inBuf, size_t l, size_t nmemb, void *pURL) {
-    URL_t *URL = (URL_t*) pURL;
-    void *p = URL->memBuf;
-    size_t copied = l*nmemb;
-    if(!p) return 0;
-
-    p += URL->bufLen;
-    if(l*nmemb > URL->bufSize - URL->bufPos) { //We received more than we can store!
-        copied = URL->bufSize - URL->bufLen;
-    }
-    memcpy(p, inBuf, copied);
-    URL->bufLen += copied;
-
-    if(!URL->memBuf) return 0; //signal error
-    return copied;
-}
-
 //Seek to an arbitrary location, returning a CURLcode
 //Note that a local file returns CURLE_OK on success or CURLE_FAILED_INIT on any error;
 CURLcode urlSeek(URL_t *URL, size_t pos) {
-#ifndef NOCURL
-    char range[1024];
-    CURLcode rv;
+    //As with fseek, seeking past the end is allowed, but subsequent reads will fail
+    if(URL->type == BWG_MMAP || URL->type == BWG_MEMORY) {
+        URL->bufPos = pos;
+        return CURLE_OK;
+    }
+    if(URL->type == BWG_BACKEND) {
+        URL->filePos = pos;
+        return CURLE_OK;
+    }
 
+#ifndef NOCURL
     if(URL->type == BWG_FILE) {
 #endif
         if(fseek(URL->x.fp, pos, SEEK_SET) == 0) {
@@ -132,30 +751,221 @@ CURLcode urlSeek(URL_t *URL, size_t pos) {
         }
 #ifndef NOCURL
     } else {
-        //If the location is covered by the buffer then don't seek!
-        if(pos < URL->filePos || pos >= URL->filePos+URL->bufLen) {
-            URL->filePos = pos;
-            URL->bufLen = 0; //Otherwise, filePos will get incremented on the next read!
-            URL->bufPos = 0;
-            //Maybe this works for FTP?
-            sprintf(range,"%lu-%lu", pos, pos+URL->bufSize-1);
-            rv = curl_easy_setopt(URL->x.curl, CURLOPT_RANGE, range);
-            if(rv != CURLE_OK) {
-                fprintf(stderr, "[urlSeek] Couldn't set the range (%s)\n", range);
-                return rv;
-            }
-            rv = curl_easy_perform(URL->x.curl);
-            if(rv != CURLE_OK) {
-                fprintf(stderr, "[urlSeek] curl_easy_perform received an error!\n");
+        //Nothing is fetched until the next read
+        URL->filePos = pos;
+        URL->bufPos = 0;
+        return CURLE_OK;
+    }
+#endif
+}
+
+//Replace the FILE * of a local file with a read-only mapping of the whole file
+//On failure (e.g., an empty file or something that isn't a regular file) the FILE * is left in place
+static void urlMmap(URL_t *URL) {
+    struct stat st;
+    void *p;
+
+    if(fstat(fileno(URL->x.fp), &st) != 0) return;
+    if(!S_ISREG(st.st_mode) || st.st_size <= 0) return;
+    if((uint64_t) st.st_size > (size_t) -1) return;
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(URL->x.fp), 0);
+    if(p == MAP_FAILED) {
+        errno = 0;
+        return;
+    }
+
+    fclose(URL->x.fp);
+    URL->x.fp = NULL;
+    URL->memBuf = p;
+    URL->bufSize = URL->bufLen = st.st_size;
+    URL->filePos = 0;
+    URL->bufPos = 0;
+    URL->type = BWG_MMAP;
+}
+
+//Unlike urlSeek()+urlRead(), this doesn't use or change the file position of local files
+//Remote files share a page cache and connection, so access to them is serialized
+size_t urlReadAt(URL_t *URL, size_t pos, void *buf, size_t bufSize) {
+    size_t rv = 0;
+    ssize_t n;
+
+    if(URL->type == BWG_MMAP || URL->type == BWG_MEMORY) {
+        if(pos > URL->bufLen || bufSize > URL->bufLen - pos) return 0;
+        memcpy(buf, (char*)URL->memBuf + pos, bufSize);
+        return bufSize;
+    }
+
+    if(URL->type == BWG_BACKEND) {
+        //If the size is known, don't ask for anything past the end
+        if(URL->bufLen) {
+            if(pos >= URL->bufLen) return 0;
+            if(bufSize > URL->bufLen - pos) bufSize = URL->bufLen - pos;
+        }
+        return URL->backend->readAt(URL->backendData, pos, buf, bufSize);
+    }
+
+    if(URL->type == BWG_FILE) {
+        while(rv < bufSize) {
+            n = pread(fileno(URL->x.fp), (char*)buf + rv, bufSize - rv, pos + rv);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            rv += n;
+        }
+        errno = 0;
+        return rv;
+    }
+
+#ifndef NOCURL
+    pthread_mutex_lock(&(URL->lock));
+    //Large reads bypass the page cache, unless the pages should be stored on disk
+    if(bufSize > URL->bufSize && !URL->onDisk) rv = urlFetchRange(URL, pos, buf, bufSize);
+    else rv = urlReadPages(URL, pos, buf, bufSize);
+    pthread_mutex_unlock(&(URL->lock));
+#endif
+    return rv;
+}
+
+#ifndef NOCURL
+//Concurrently fetch all of the pages covering the ranges that aren't already cached and add them to the cache
+//Returns 0 on success
+static int urlPrefetchPages(URL_t *URL, size_t n, const size_t *pos, const size_t *len) {
+    size_t i, p, last, pageLen, nRuns = 0, total = 0, *runPos = NULL, *runLen = NULL, *tmp;
+    char *buf = NULL, *data;
+    urlPage_t *page;
+    int rv = -1;
+
+    for(i=0; i<n; i++) {
+        if(!len[i]) continue;
+        last = pos[i] + len[i] - 1;
+        for(p = pos[i] - pos[i] % URL->bufSize; p <= last; p += URL->bufSize) {
+            pageLen = urlPageLen(URL, p);
+            if(!pageLen) break;
+            if(urlDiskHasPage(URL, p) || urlFindPage(URL, p)) continue;
+            if(nRuns && p < runPos[nRuns-1] + runLen[nRuns-1]) continue; //Already included
+            if(nRuns && p == runPos[nRuns-1] + runLen[nRuns-1]) {
+                runLen[nRuns-1] += pageLen;
+            } else {
+                tmp = realloc(runPos, (nRuns+1) * sizeof(size_t));
+                if(!tmp) goto cleanup;
+                runPos = tmp;
+                tmp = realloc(runLen, (nRuns+1) * sizeof(size_t));
+                if(!tmp) goto cleanup;
+                runLen = tmp;
+                runPos[nRuns] = p;
+                runLen[nRuns++] = pageLen;
             }
-            errno = 0;  //Don't propogate remnant resolved libCurl errors
-            return rv;
+            total += pageLen;
+        }
+    }
+    if(!nRuns) {
+        rv = 0;
+        goto cleanup;
+    }
+
+    buf = malloc(total);
+    if(!buf) goto cleanup;
+    if(nRuns > 1 && GLOBAL_REMOTEPARALLELISM > 1) {
+        if(urlFetchRanges(URL, nRuns, runPos, runLen, buf)) goto cleanup;
+    } else {
+        for(i=0, data=buf; i<nRuns; data+=runLen[i++]) {
+            if(urlFetchRange(URL, runPos[i], data, runLen[i]) != runLen[i]) goto cleanup;
+        }
+    }
+
+    for(i=0, data=buf; i<nRuns; i++) {
+        for(p=runPos[i]; p<runPos[i]+runLen[i]; p+=URL->bufSize) {
+            pageLen = urlPageLen(URL, p);
+            urlDiskWritePage(URL, p, data, pageLen);
+            page = malloc(sizeof(urlPage_t) + URL->bufSize);
+            if(!page) goto cleanup;
+            page->pos = p;
+            page->len = pageLen;
+            page->data = (char*) (page + 1);
+            memcpy(page->data, data, pageLen);
+            urlPushPage(URL, page);
+            data += pageLen;
+        }
+    }
+    rv = 0;
+
+cleanup:
+    urlTrimPages(URL);
+    free(runPos);
+    free(runLen);
+    free(buf);
+    return rv;
+}
+#endif
+
+//Ask the kernel to start reading ranges of a local file in the background
+//This is only a hint, so errors are ignored
+static void urlAdvise(URL_t *URL, size_t n, const size_t *pos, const size_t *len) {
+    size_t i, start, end;
+#ifdef MADV_WILLNEED
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+#endif
+
+    for(i=0; i<n; i++) {
+        if(!len[i]) continue;
+        start = pos[i];
+        end = pos[i] + len[i];
+        if(URL->type == BWG_MMAP) {
+#ifdef MADV_WILLNEED
+            if(start >= URL->bufLen) continue;
+            if(end > URL->bufLen) end = URL->bufLen;
+            start -= start % pageSize;
+            madvise((char*)URL->memBuf + start, end - start, MADV_WILLNEED);
+#endif
         } else {
-            URL->bufPos = pos-URL->filePos;
-            return CURLE_OK;
+#ifdef POSIX_FADV_WILLNEED
+            posix_fadvise(fileno(URL->x.fp), start, end - start, POSIX_FADV_WILLNEED);
+#endif
+        }
+    }
+    errno = 0;
+}
+
+int urlPrefetch(URL_t *URL, size_t n, const size_t *pos, const size_t *len) {
+    int rv = 0;
+    if(URL->type == BWG_FILE || URL->type == BWG_MMAP) {
+        urlAdvise(URL, n, pos, len);
+        return 0;
+    }
+    if(URL->type == BWG_MEMORY || URL->type == BWG_BACKEND) return 0;
+#ifndef NOCURL
+    pthread_mutex_lock(&(URL->lock));
+    rv = urlPrefetchPages(URL, n, pos, len);
+    pthread_mutex_unlock(&(URL->lock));
+#endif
+    return rv;
+}
+
+int urlReadRanges(URL_t *URL, size_t n, const size_t *pos, const size_t *len, void *buf) {
+    char *p = buf;
+    size_t i;
+
+#ifndef NOCURL
+    int rv;
+    if(n > 1 && GLOBAL_REMOTEPARALLELISM > 1 && !urlIsLocal(URL) && URL->type != BWG_BACKEND) {
+        if(URL->onDisk) {
+            //Fetch the missing pages at once, the ranges are then read from the cache below
+            //Any errors are ignored, since the pages will then simply be fetched again
+            urlPrefetch(URL, n, pos, len);
+        } else {
+            pthread_mutex_lock(&(URL->lock));
+            rv = urlFetchRanges(URL, n, pos, len, buf);
+            pthread_mutex_unlock(&(URL->lock));
+            if(rv == 0) return 0;
+            //Otherwise, fall back to fetching one range at a time
         }
     }
 #endif
+
+    for(i=0; i<n; i++) {
+        if(urlReadAt(URL, pos[i], p, len[i]) != len[i]) return -1;
+        p += len[i];
+    }
+    return 0;
 }
 
 URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode) {
@@ -164,7 +974,9 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
     char *url = NULL, *req = NULL;
 #ifndef NOCURL
     CURLcode code;
-    char range[1024];
+    struct urlValidator_t validator;
+    urlPage_t *page;
+    memset(&validator, 0, sizeof(struct urlValidator_t));
 #endif
 
     URL->fname = fname;
@@ -189,17 +1001,15 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
                 fprintf(stderr, "[urlOpen] Couldn't open %s for reading\n", fname);
                 return NULL;
             }
+            urlMmap(URL);
 #ifndef NOCURL
         } else {
-            //Remote file, set up the memory buffer and get CURL ready
-            URL->memBuf = malloc(GLOBAL_DEFAULTBUFFERSIZE);
-            if(!(URL->memBuf)) {
-                free(URL);
-                fprintf(stderr, "[urlOpen] Couldn't allocate enough space for the file buffer!\n");
-                return NULL;
-            }
+            //Remote file, set up the page cache and get CURL ready
             URL->bufSize = GLOBAL_DEFAULTBUFFERSIZE;
-            URL->x.curl = curl_easy_init();
+            URL->maxPages = GLOBAL_REMOTECACHESIZE / URL->bufSize;
+            if(URL->maxPages < 2) URL->maxPages = 2;
+            pthread_mutex_init(&(URL->lock), NULL);
+            URL->x.curl = urlGetHandle(fname);
             if(!(URL->x.curl)) {
                 fprintf(stderr, "[urlOpen] curl_easy_init() failed!\n");
                 goto error;
@@ -219,21 +1029,11 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
                 fprintf(stderr, "[urlOpen] Couldn't set CURLOPT_URL!\n");
                 goto error;
             }
-            //Set the range, which doesn't do anything for HTTP
-            sprintf(range, "0-%lu", URL->bufSize-1);
-            if(curl_easy_setopt(URL->x.curl, CURLOPT_RANGE, range) != CURLE_OK) {
-                fprintf(stderr, "[urlOpen] Couldn't set CURLOPT_RANGE (%s)!\n", range);
-                goto error;
-            }
-            //Set the callback info, which means we no longer need to directly deal with sockets and header!
-            if(curl_easy_setopt(URL->x.curl, CURLOPT_WRITEFUNCTION, bwFillBuffer) != CURLE_OK) {
+            //Set the callback, which means we no longer need to directly deal with sockets and header! The data pointer is set for each request.
+            if(curl_easy_setopt(URL->x.curl, CURLOPT_WRITEFUNCTION, bwFillRange) != CURLE_OK) {
                 fprintf(stderr, "[urlOpen] Couldn't set CURLOPT_WRITEFUNCTION!\n");
                 goto error;
             }
-            if(curl_easy_setopt(URL->x.curl, CURLOPT_WRITEDATA, (void*)URL) != CURLE_OK) {
-                fprintf(stderr, "[urlOpen] Couldn't set CURLOPT_WRITEDATA!\n");
-                goto error;
-            }
             //Ignore certificate errors with https, libcurl just isn't reliable enough with conda
             if(curl_easy_setopt(URL->x.curl, CURLOPT_SSL_VERIFYPEER, 0) != CURLE_OK) {
                 fprintf(stderr, "[urlOpen] Couldn't set CURLOPT_SSL_VERIFYPEER to 0!\n");
@@ -250,12 +1050,22 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
                     goto error;
                 }
             }
-            code = curl_easy_perform(URL->x.curl);
-            errno = 0; //Sometimes curl_easy_perform leaves a random errno remnant
-            if(code != CURLE_OK) {
-                fprintf(stderr, "[urlOpen] curl_easy_perform received an error: %s\n", curl_easy_strerror(code));
+            //Fetch the start of the file, which is needed for the header anyway
+            //The response also gives the file size and indicates whether a copy in the on-disk cache is still valid
+            if(curl_easy_setopt(URL->x.curl, CURLOPT_HEADERFUNCTION, urlNoteHeader) != CURLE_OK) goto error;
+            if(curl_easy_setopt(URL->x.curl, CURLOPT_HEADERDATA, (void*)&validator) != CURLE_OK) goto error;
+            page = urlGetPage(URL, 0, 0);
+            if(!page) {
+                fprintf(stderr, "[urlOpen] Couldn't fetch the start of %s\n", fname);
                 goto error;
             }
+            if(curl_easy_setopt(URL->x.curl, CURLOPT_HEADERFUNCTION, NULL) != CURLE_OK) goto error;
+            if(curl_easy_setopt(URL->x.curl, CURLOPT_HEADERDATA, NULL) != CURLE_OK) goto error;
+            URL->fileLen = validator.length;
+            if(GLOBAL_CACHEDIR) {
+                urlOpenDiskCache(URL, &validator);
+                urlDiskWritePage(URL, 0, page->data, page->len);
+            }
 #endif
         }
     } else {
@@ -275,21 +1085,67 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
 error:
     if(url) free(url);
     if(req) free(req);
-    free(URL->memBuf);
+    urlDestroyPages(URL);
+    urlCloseDiskCache(URL);
     curl_easy_cleanup(URL->x.curl);
+    pthread_mutex_destroy(&(URL->lock));
     free(URL);
     return NULL;
 #endif
 }
 
+URL_t *urlOpenMemory(const void *buf, size_t len) {
+    URL_t *URL = calloc(1, sizeof(URL_t));
+    if(!URL) return NULL;
+
+    URL->type = BWG_MEMORY;
+    URL->memBuf = (void*) buf;
+    URL->bufSize = URL->bufLen = len;
+    return URL;
+}
+
+URL_t *urlOpenBackend(const bwBackend_t *backend, void *data) {
+    URL_t *URL = calloc(1, sizeof(URL_t));
+    if(!URL || !backend->readAt) {
+        if(backend->close) backend->close(data);
+        free(URL);
+        return NULL;
+    }
+
+    URL->type = BWG_BACKEND;
+    URL->backend = backend;
+    URL->backendData = data;
+    if(backend->size) URL->bufLen = backend->size(data);
+    return URL;
+}
+
+int urlIsLocal(const URL_t *URL) {
+    return (URL->type == BWG_FILE || URL->type == BWG_MMAP || URL->type == BWG_MEMORY);
+}
+
 //Performs the necessary free() operations and handles cleaning up curl
 void urlClose(URL_t *URL) {
-    if(URL->type == BWG_FILE) {
+#ifndef NOCURL
+    int i;
+#endif
+    if(URL->type == BWG_MMAP) {
+        munmap(URL->memBuf, URL->bufSize);
+    } else if(URL->type == BWG_MEMORY) {
+        //The buffer belongs to the caller
+    } else if(URL->type == BWG_BACKEND) {
+        if(URL->backend->close) URL->backend->close(URL->backendData);
+    } else if(URL->type == BWG_FILE) {
         fclose(URL->x.fp);
 #ifndef NOCURL
     } else {
-        free(URL->memBuf);
-        curl_easy_cleanup(URL->x.curl);
+        urlDestroyPages(URL);
+        urlCloseDiskCache(URL);
+        //The connections are kept open for other files on the same host
+        urlReleaseHandle(URL->fname, URL->x.curl);
+        for(i=0; i<URL->nEasy; i++) urlReleaseHandle(URL->fname, URL->easy[i]);
+        if(URL->easy) free(URL->easy);
+        if(URL->multi) curl_multi_cleanup(URL->multi);
+        pthread_mutex_destroy(&(URL->lock));
 #endif
     }
     free(URL);
@@ -215,19 +215,80 @@ PyObject* pyBwEnter(pyBigWigFile_t*self, PyObject *args) {
     return (PyObject*) self;
 }
 
+//Is the object a buffer that might hold a file, rather than a file name?
+static int isFileContents(PyObject *obj) {
+#if PY_MAJOR_VERSION < 3
+    if(PyString_Check(obj) || PyUnicode_Check(obj)) return 0;
+#else
+    if(PyUnicode_Check(obj)) return 0;
+#endif
+    return PyObject_CheckBuffer(obj);
+}
+
+PyObject *pySetLazyChromThreshold(PyObject *self, PyObject *args) {
+    unsigned long long n;
+
+    if(!PyArg_ParseTuple(args, "K", &n)) {
+        PyErr_SetString(PyExc_RuntimeError, "The threshold must be a non-negative number!");
+        return NULL;
+    }
+    bwSetLazyChromThreshold(n);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject *pySetThreads(PyObject *self, PyObject *args) {
+    int n;
+
+    if(!PyArg_ParseTuple(args, "i", &n)) {
+        PyErr_SetString(PyExc_RuntimeError, "The number of threads must be an integer!");
+        return NULL;
+    }
+    if(bwSetThreads(n)) {
+        PyErr_SetString(PyExc_RuntimeError, "Not every thread could be started!");
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 PyObject* pyBwOpen(PyObject *self, PyObject *pyFname) {
     char *fname = NULL;
     char *mode = "r";
     pyBigWigFile_t *pybw;
     bigWigFile_t *bw = NULL;
+    PyObject *source = NULL;
+    Py_buffer *view = NULL;
 
-    if(!PyArg_ParseTuple(pyFname, "s|s", &fname, &mode)) goto error;
+    if(!PyArg_ParseTuple(pyFname, "O|s", &source, &mode)) goto error;
 
-    //Open the local/remote file
-    if(strchr(mode, 'w') != NULL || bwIsBigWig(fname, NULL)) {
-        bw = bwOpen(fname, NULL, mode);
+    if(isFileContents(source)) {
+        //Open a file held in memory, keeping the buffer until the file is closed
+        if(strchr(mode, 'w') != NULL) {
+            PyErr_SetString(PyExc_RuntimeError, "Files in memory can only be opened for reading!");
+            return NULL;
+        }
+        view = PyMem_Malloc(sizeof(Py_buffer));
+        if(!view) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        if(PyObject_GetBuffer(source, view, PyBUF_SIMPLE)) {
+            PyMem_Free(view);
+            return NULL;
+        }
+        bw = bwOpenFromMemory(view->buf, view->len);
     } else {
-        bw = bbOpen(fname, NULL);
+        if(!PyArg_ParseTuple(pyFname, "s|s", &fname, &mode)) goto error;
+
+        //Open the local/remote file
+        if(strchr(mode, 'w') != NULL) {
+            bw = bwOpen(fname, NULL, mode);
+        } else {
+            bw = bwOpenAny(fname, NULL);
+        }
     }
     if(!bw) {
         fprintf(stderr, "[pyBwOpen] bw is NULL!\n");
@@ -248,22 +309,37 @@ PyObject* pyBwOpen(PyObject *self, PyObject *pyFname) {
     pybw->lastSpan = (uint32_t) -1;
     pybw->lastStep = (uint32_t) -1;
     pybw->lastStart = (uint32_t) -1;
+    pybw->view = view;
     return (PyObject*) pybw;
 
 error:
     if(bw) bwClose(bw);
+    if(view) {
+        PyBuffer_Release(view);
+        PyMem_Free(view);
+    }
     PyErr_SetString(PyExc_RuntimeError, "Received an error during file opening!");
     return NULL;
 }
 
+//The buffer of a file opened from memory can only be released once the file is closed
+static void pyBwReleaseView(pyBigWigFile_t *self) {
+    if(!self->view) return;
+    PyBuffer_Release(self->view);
+    PyMem_Free(self->view);
+    self->view = NULL;
+}
+
 static void pyBwDealloc(pyBigWigFile_t *self) {
     if(self->bw) bwClose(self->bw);
+    pyBwReleaseView(self);
     PyObject_DEL(self);
 }
 
 static PyObject *pyBwClose(pyBigWigFile_t *self, PyObject *args) {
     bwClose(self->bw);
     self->bw = NULL;
+    pyBwReleaseView(self);
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -314,6 +390,27 @@ error :
     return NULL;
 }
 
+static PyObject *pyBwFlattenIndex(pyBigWigFile_t *self, PyObject *args) {
+    bigWigFile_t *bw = self->bw;
+
+    if(!bw) {
+        PyErr_SetString(PyExc_RuntimeError, "The bigWig file handle is not opened!");
+        return NULL;
+    }
+    if(bw->isWrite == 1) {
+        PyErr_SetString(PyExc_RuntimeError, "The index cannot be loaded in files opened for writing!");
+        return NULL;
+    }
+
+    if(bwFlattenIndex(bw)) {
+        PyErr_SetString(PyExc_RuntimeError, "Received an error while loading the index!");
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 //Accessor for the chroms, args is optional
 static PyObject *pyBwGetChroms(pyBigWigFile_t *self, PyObject *args) {
     PyObject *ret = NULL, *val;
@@ -332,6 +429,10 @@ static PyObject *pyBwGetChroms(pyBigWigFile_t *self, PyObject *args) {
     }
 
     if(!(PyArg_ParseTuple(args, "|s", &chrom)) || !chrom) {
+        if(bwLoadChroms(bw)) {
+            PyErr_SetString(PyExc_RuntimeError, "Received an error while reading the chromosome list!");
+            return NULL;
+        }
         ret = PyDict_New();
         for(i=0; i<bw->cl->nKeys; i++) {
             val = PyLong_FromUnsignedLong(bw->cl->len[i]);
@@ -339,12 +440,8 @@ static PyObject *pyBwGetChroms(pyBigWigFile_t *self, PyObject *args) {
             Py_DECREF(val);
         }
     } else {
-        for(i=0; i<bw->cl->nKeys; i++) {
-            if(strcmp(bw->cl->chrom[i],chrom) == 0) {
-                ret = PyLong_FromUnsignedLong(bw->cl->len[i]);
-                break;
-            }
-        }
+        i = bwGetTid(bw, chrom);
+        if(i != (uint32_t) -1) ret = PyLong_FromUnsignedLong(bw->cl->len[i]);
     }
 
     if(!ret) {
@@ -379,11 +476,12 @@ static PyObject *pyBwGetStats(pyBigWigFile_t *self, PyObject *args, PyObject *kw
     double *val;
     uint32_t start, end = -1, tid;
     unsigned long startl = 0, endl = -1;
-    static char *kwd_list[] = {"chrom", "start", "end", "type", "nBins", "exact", "numpy", NULL};
+    static char *kwd_list[] = {"chrom", "start", "end", "type", "nBins", "exact", "numpy", "binSize", NULL};
     char *chrom, *type = "mean";
     PyObject *ret, *exact = Py_False, *starto = NULL, *endo = NULL;
     PyObject *outputNumpy = Py_False;
-    int i, nBins = 1;
+    int i, nBins = 0, binSize = 0;
+    uint64_t nBinSizeBins;
     errno = 0; //In the off-chance that something elsewhere got an error and didn't clear it...
 
     if(!bw) {
@@ -401,11 +499,17 @@ static PyObject *pyBwGetStats(pyBigWigFile_t *self, PyObject *args, PyObject *kw
         return NULL;
     }
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|OOsiOO", kwd_list, &chrom, &starto, &endo, &type, &nBins, &exact, &outputNumpy)) {
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|OOsiOOi", kwd_list, &chrom, &starto, &endo, &type, &nBins, &exact, &outputNumpy, &binSize)) {
         PyErr_SetString(PyExc_RuntimeError, "You must supply at least a chromosome!");
         return NULL;
     }
 
+    //Fixed-size bins replace nBins, so they can't both be given
+    if(binSize && nBins) {
+        PyErr_SetString(PyExc_RuntimeError, "Only one of nBins and binSize can be given!");
+        return NULL;
+    }
+
     //Check inputs, reset to defaults if nothing was input
     if(!nBins) nBins = 1; //For some reason, not specifying this overrides the default!
     if(!type) type = "mean";
@@ -464,6 +568,20 @@ static PyObject *pyBwGetStats(pyBigWigFile_t *self, PyObject *args, PyObject *kw
         return NULL;
     }
 
+    //Fixed-size bins replace nBins, the last bin may be shorter
+    if(binSize < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "binSize must not be negative!");
+        return NULL;
+    }
+    if(binSize) {
+        nBinSizeBins = ((uint64_t) end - start + binSize - 1) / binSize;
+        if(nBinSizeBins > INT_MAX) {
+            PyErr_SetString(PyExc_RuntimeError, "binSize is too small, there would be too many bins!");
+            return NULL;
+        }
+        nBins = nBinSizeBins;
+    }
+
     //Return a list of None if there are no entries at all
     if(!hasEntries(bw)) {
 #ifdef WITHNUMPY
@@ -490,7 +608,9 @@ static PyObject *pyBwGetStats(pyBigWigFile_t *self, PyObject *args, PyObject *kw
     }
 
     //Get the actual statistics
-    if(exact == Py_True) {
+    if(binSize) {
+        val = bwGetBinnedValues(bw, chrom, start, end, binSize, char2enum(type));
+    } else if(exact == Py_True) {
         val = bwStatsFromFull(bw, chrom, start, end, nBins, char2enum(type));
     } else {
         val = bwStats(bw, chrom, start, end, nBins, char2enum(type));
@@ -621,30 +741,31 @@ static PyObject *pyBwGetValues(pyBigWigFile_t *self, PyObject *args) {
 #endif
     }
 
-    o = bwGetValues(self->bw, chrom, start, end, 1);
-    if(!o) {
-        PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching values!");
-        return NULL;
-    }
-
 #ifdef WITHNUMPY
     if(outputNumpy == Py_True) {
+        //Decode straight into the array
         npy_intp len = end - start;
-        ret = PyArray_SimpleNewFromData(1, &len, NPY_FLOAT, (void *) o->value);
-        //This will break if numpy ever stops using malloc!
-        PyArray_ENABLEFLAGS((PyArrayObject*) ret, NPY_ARRAY_OWNDATA);
-        free(o->start);
-        free(o->end);
-        free(o);
-    } else {
-#endif
-        ret = PyList_New(end-start);
-        for(i=0; i<(int) o->l; i++) PyList_SetItem(ret, i, PyFloat_FromDouble(o->value[i]));
-        bwDestroyOverlappingIntervals(o);
-#ifdef WITHNUMPY
+        ret = PyArray_SimpleNew(1, &len, NPY_FLOAT);
+        if(!ret) return NULL;
+        if(bwGetValuesIntoTid(self->bw, tid, start, end, (float *) PyArray_DATA((PyArrayObject*) ret))) {
+            Py_DECREF(ret);
+            PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching values!");
+            return NULL;
+        }
+        return ret;
     }
 #endif
 
+    o = bwGetValuesTid(self->bw, tid, start, end, 1);
+    if(!o) {
+        PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching values!");
+        return NULL;
+    }
+
+    ret = PyList_New(end-start);
+    for(i=0; i<(int) o->l; i++) PyList_SetItem(ret, i, PyFloat_FromDouble(o->value[i]));
+    bwDestroyOverlappingIntervals(o);
+
     return ret;
 }
 
@@ -735,7 +856,7 @@ static PyObject *pyBwGetIntervals(pyBigWigFile_t *self, PyObject *args, PyObject
     }
 
     //Get the intervals
-    intervals = bwGetOverlappingIntervals(bw, chrom, start, end);
+    intervals = bwGetOverlappingIntervalsTid(bw, tid, start, end);
     if(!intervals) {
         PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching the overlapping intervals!");
         return NULL;
@@ -759,6 +880,116 @@ static PyObject *pyBwGetIntervals(pyBigWigFile_t *self, PyObject *args, PyObject
     return ret;
 }
 
+//Convert a python or numpy integer to a coordinate, returning 1 on error
+static int pyGetCoordinate(PyObject *obj, unsigned long *val) {
+#ifdef WITHNUMPY
+    if(PyArray_IsScalar(obj, Integer)) {
+        *val = (long) getNumpyL(obj);
+        return 0;
+    }
+#endif
+    if(PyLong_Check(obj)) {
+        *val = PyLong_AsLong(obj);
+        return 0;
+    }
+#if PY_MAJOR_VERSION < 3
+    if(PyInt_Check(obj)) {
+        *val = PyInt_AsLong(obj);
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+//Return the starts, lengths and values of runs of equal values
+static PyObject *pyBwGetRuns(pyBigWigFile_t *self, PyObject *args, PyObject *kwds) {
+    bigWigFile_t *bw = self->bw;
+    uint32_t start, end, tid, i;
+    unsigned long startl = 0, endl = -1;
+    static char *kwd_list[] = {"chrom", "start", "end", NULL};
+    bwOverlappingIntervals_t *runs = NULL;
+    char *chrom;
+    PyObject *starts = NULL, *lengths = NULL, *values = NULL, *starto = NULL, *endo = NULL;
+
+    if(!bw) {
+        PyErr_SetString(PyExc_RuntimeError, "The bigWig file handle is not opened!");
+        return NULL;
+    }
+
+    if(bw->isWrite == 1) {
+        PyErr_SetString(PyExc_RuntimeError, "Runs cannot be accessed in files opened for writing!");
+        return NULL;
+    }
+
+    if(bw->type == 1) {
+        PyErr_SetString(PyExc_RuntimeError, "bigBed files have no values! Use 'entries()' instead.");
+        return NULL;
+    }
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|OO", kwd_list, &chrom, &starto, &endo)) {
+        PyErr_SetString(PyExc_RuntimeError, "You must supply at least a chromosome.\n");
+        return NULL;
+    }
+
+    if((starto && pyGetCoordinate(starto, &startl)) || (endo && pyGetCoordinate(endo, &endl))) {
+        PyErr_SetString(PyExc_RuntimeError, "The start and end coordinates must be numbers!");
+        return NULL;
+    }
+
+    //Sanity check
+    tid = bwGetTid(bw, chrom);
+    if(endl == (unsigned long) -1 && tid != (uint32_t) -1) endl = bw->cl->len[tid];
+    if(tid == (uint32_t) -1 || startl >= endl || endl > bw->cl->len[tid]) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid interval bounds!");
+        return NULL;
+    }
+    start = (uint32_t) startl;
+    end = (uint32_t) endl;
+
+    //Empty files have no runs
+    if(hasEntries(bw)) {
+        runs = bwGetValueRunsTid(bw, tid, start, end);
+        if(!runs) {
+            PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching the runs!");
+            return NULL;
+        }
+    }
+
+#ifdef WITHNUMPY
+    npy_intp len = runs ? runs->l : 0;
+    starts = PyArray_SimpleNew(1, &len, NPY_UINT32);
+    lengths = PyArray_SimpleNew(1, &len, NPY_UINT32);
+    values = PyArray_SimpleNew(1, &len, NPY_FLOAT32);
+    if(!starts || !lengths || !values) goto error;
+    for(i=0; i<len; i++) {
+        ((uint32_t*) PyArray_DATA((PyArrayObject*) starts))[i] = runs->start[i];
+        ((uint32_t*) PyArray_DATA((PyArrayObject*) lengths))[i] = runs->end[i] - runs->start[i];
+        ((float*) PyArray_DATA((PyArrayObject*) values))[i] = runs->value[i];
+    }
+#else
+    uint32_t len = runs ? runs->l : 0;
+    starts = PyList_New(len);
+    lengths = PyList_New(len);
+    values = PyList_New(len);
+    if(!starts || !lengths || !values) goto error;
+    for(i=0; i<len; i++) {
+        PyList_SetItem(starts, i, PyLong_FromUnsignedLong(runs->start[i]));
+        PyList_SetItem(lengths, i, PyLong_FromUnsignedLong(runs->end[i] - runs->start[i]));
+        PyList_SetItem(values, i, PyFloat_FromDouble(runs->value[i]));
+    }
+#endif
+
+    bwDestroyOverlappingIntervals(runs);
+    return Py_BuildValue("(NNN)", starts, lengths, values);
+
+error:
+    Py_XDECREF(starts);
+    Py_XDECREF(lengths);
+    Py_XDECREF(values);
+    bwDestroyOverlappingIntervals(runs);
+    return NULL;
+}
+
 #if PY_MAJOR_VERSION >= 3
 //Return 1 iff obj is a ready unicode type
 int PyString_Check(PyObject *obj) {
@@ -1817,7 +2048,7 @@ static PyObject *pyBBGetEntries(pyBigWigFile_t *self, PyObject *args, PyObject *
 
     if(withStringPy == Py_False) withString = 0;
 
-    o = bbGetOverlappingEntries(bw, chrom, start, end, withString);
+    o = bbGetOverlappingEntriesTid(bw, tid, start, end, withString);
     if(!o) {
         PyErr_SetString(PyExc_RuntimeError, "An error occurred while fetching the overlapping entries!\n");
         return NULL;
@@ -1922,13 +2153,21 @@ PyMODINIT_FUNC initpyBigWig(void) {
 #if PY_MAJOR_VERSION >= 3
     if(Py_AtExit(bwCleanup)) return NULL;
     if(PyType_Ready(&bigWigFile) < 0) return NULL;
-    if(bwInit(128000)) return NULL;
+    if(bwInit(128000)) {
+        PyErr_SetString(PyExc_ImportError, "Couldn't initialize libBigWig!");
+        return NULL;
+    }
+    bwSetLazyChromThreshold(LAZYCHROMS);
     res = PyModule_Create(&pyBigWigmodule);
     if(!res) return NULL;
 #else
     if(Py_AtExit(bwCleanup)) return;
     if(PyType_Ready(&bigWigFile) < 0) return;
-    if(bwInit(128000)) return;
+    if(bwInit(128000)) {
+        PyErr_SetString(PyExc_ImportError, "Couldn't initialize libBigWig!");
+        return;
+    }
+    bwSetLazyChromThreshold(LAZYCHROMS);
     res = Py_InitModule3("pyBigWig", bwMethods, "A module for handling bigWig files");
 #endif
 
@@ -3,6 +3,8 @@
 #include "bigWig.h"
 
 #define pyBigWigVersion "0.3.24"
+//Files with more chromosomes than this read their names only as needed
+#define LAZYCHROMS 1000000
 
 typedef struct {
     PyObject_HEAD
@@ -12,9 +14,12 @@ typedef struct {
     uint32_t lastStep; //The step of the last written entry (if applicable)
     uint32_t lastStart; //The next start position (if applicable)
     int lastType; //The type of the last written entry
+    Py_buffer *view; //For files opened from memory, the buffer holding the file (otherwise NULL)
 } pyBigWigFile_t;
 
 static PyObject *pyBwOpen(PyObject *self, PyObject *pyFname);
+static PyObject *pySetLazyChromThreshold(PyObject *self, PyObject *args);
+static PyObject *pySetThreads(PyObject *self, PyObject *args);
 static PyObject *pyBwEnter(pyBigWigFile_t *self, PyObject *args);
 static PyObject *pyBwClose(pyBigWigFile_t *pybw, PyObject *args);
 static PyObject *pyBwGetChroms(pyBigWigFile_t *pybw, PyObject *args);
@@ -27,9 +32,11 @@ static PyObject *pyBwGetValues(pyBigWigFile_t *pybw, PyObject *args, PyObject *k
 static PyObject *pyBwGetValues(pyBigWigFile_t *pybw, PyObject *args);
 #endif
 static PyObject *pyBwGetIntervals(pyBigWigFile_t *pybw, PyObject *args, PyObject *kwds);
+static PyObject *pyBwGetRuns(pyBigWigFile_t *pybw, PyObject *args, PyObject *kwds);
 	static PyObject *pyBBGetEntries(pyBigWigFile_t *pybw, PyObject *args, PyObject *kwds);
 static PyObject *pyBBGetSQL(pyBigWigFile_t *pybw, PyObject *args);
 static PyObject *pyBwGetHeader(pyBigWigFile_t *pybw, PyObject *args);
+static PyObject *pyBwFlattenIndex(pyBigWigFile_t *pybw, PyObject *args);
 static PyObject *pyBwAddHeader(pyBigWigFile_t *pybw, PyObject *args, PyObject *kwds);
 static PyObject *pyBwAddEntries(pyBigWigFile_t *pybw, PyObject *args, PyObject *kwds);
 static void pyBwDealloc(pyBigWigFile_t *pybw);
@@ -38,7 +45,8 @@ static void pyBwDealloc(pyBigWigFile_t *pybw);
 static PyMethodDef bwMethods[] = {
     {"open", (PyCFunction)pyBwOpen, METH_VARARGS,
 "Open a bigWig or bigBed file. For remote files, give a URL starting with HTTP,\n\
-FTP, or HTTPS.\n\
+FTP, or HTTPS. A file already in memory can be given as a bytes-like object\n\
+(e.g., bytes or a memoryview), which is then read in place.\n\
 \n\
 Optional arguments:\n\
     mode: An optional mode. The default is 'r', which opens a file for reading.\n\
@@ -50,10 +58,33 @@ Returns:\n\
    A bigWigFile object on success, otherwise None.\n\
 \n\
 Arguments:\n\
-    file: The name of a bigWig file.\n\
+    file: The name of a bigWig file, or its contents.\n\
 \n\
 >>> import pyBigWig\n\
 >>> bw = pyBigWig.open(\"some_file.bw\")\n"},
+    {"setLazyChromThreshold", (PyCFunction)pySetLazyChromThreshold, METH_VARARGS,
+"Set the number of chromosomes above which files opened afterwards read their\n\
+chromosome names from disk only as they're needed, rather than all at once.\n\
+The default is 1000000. A value of 0 means that the names are always read at\n\
+once. chroms() without arguments still returns every chromosome.\n\
+\n\
+Arguments:\n\
+    n: The number of chromosomes.\n\
+\n\
+>>> import pyBigWig\n\
+>>> pyBigWig.setLazyChromThreshold(100000)\n"},
+    {"setThreads", (PyCFunction)pySetThreads, METH_VARARGS,
+"Set the number of threads used to decode the data blocks of queries that\n\
+overlap many of them, such as values() or intervals() over a whole chromosome.\n\
+The results are the same as with a single thread. The threads are shared by\n\
+every file, so this shouldn't be called while other threads are querying files.\n\
+The default is 1.\n\
+\n\
+Arguments:\n\
+    n: The number of threads.\n\
+\n\
+>>> import pyBigWig\n\
+>>> pyBigWig.setThreads(4)\n"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -74,6 +105,18 @@ These are returned as a dictionary.\n\
 >>> bw.header()\n\
 {'maxVal': 2L, 'sumData': 272L, 'minVal': 0L, 'version': 4L,\n\
 'sumSquared': 500L, 'nLevels': 1L, 'nBasesCovered': 154L}\n\
+>>> bw.close()\n"},
+    {"flattenIndex", (PyCFunction)pyBwFlattenIndex, METH_VARARGS,
+"Load the whole index of a file into memory, so that each query finds the data\n\
+it needs with a binary search rather than by reading the index from the file.\n\
+This is worthwhile when a file will receive many queries. Their results are\n\
+unchanged.\n\
+\n\
+>>> import pyBigWig\n\
+>>> bw = pyBigWig.open(\"some_file.bw\")\n\
+>>> bw.flattenIndex()\n\
+>>> bw.values(\"1\", 0, 3)\n\
+[0.10000000149011612, 0.20000000298023224, 0.30000001192092896]\n\
 >>> bw.close()\n"},
     {"close", (PyCFunction)pyBwClose, METH_VARARGS,
 "Close a bigWig file.\n\
@@ -140,6 +183,11 @@ Keyword arguments:\n\
            on github for further information on this). To avoid this behaviour,\n\
            simply specify 'exact=True'. Note that values returned will then\n\
            differ from what UCSC, IGV, and similar other tools will report.\n\
+    binSize: Instead of nBins, divide the range into bins of this many bases.\n\
+           The last bin is shorter if the range isn't a multiple of this.\n\
+           Statistics are then always exact, regardless of 'exact', and are\n\
+           computed in a single pass over the range, which is much faster\n\
+           for many small bins. This can't be combined with nBins.\n\
 \n\
 >>> import pyBigWig\n\
 >>> bw = pyBigWig.open(\"test/test.bw\")\n\
@@ -164,7 +212,9 @@ by default. Other possibilites for 'type' are: 'min' (minimum value),\n\
 >>> bw.stats(\"1\", 0, 3, type=\"std\")\n\
 [0.10000000521540645]\n\
 >>> bw.stats(\"1\",99,200, type=\"max\", nBins=2)\n\
-[1.399999976158142, 1.5]\n"},
+[1.399999976158142, 1.5]\n\
+>>> bw.stats(\"1\", 0, 150, binSize=100)\n\
+[0.2000000054637591, 1.399999976158142]\n"},
 #ifdef WITHNUMPY
     {"values", (PyCFunction)pyBwGetValues, METH_VARARGS|METH_KEYWORDS,
 "Retrieve the value stored for each position (or None). On error, a runtime\n\
@@ -236,6 +286,30 @@ end of 10 specifies the first 10 positions).\n\
 >>> bw.intervals(\"1\", 0, 3)\n\
 ((0, 1, 0.10000000149011612), (1, 2, 0.20000000298023224),\n\
  (2, 3, 0.30000001192092896))\n\
+>>> bw.close()"},
+    {"runs", (PyCFunction)pyBwGetRuns, METH_VARARGS|METH_KEYWORDS,
+"Retrieve the runs of equal values in a chromosome/region. This is a compact\n\
+alternative to values() for tracks that are piecewise constant. On error, a\n\
+runtime exception is thrown.\n\
+\n\
+Positional arguments:\n\
+    chr:   Chromosome name\n\
+\n\
+Keyword arguments:\n\
+    start: Starting position\n\
+    end:   Ending position\n\
+\n\
+If start and end aren't specified, the entire chromosome is used. Intervals\n\
+are clipped to the region and adjacent ones with the same value are merged.\n\
+A tuple of the starting positions, lengths, and values of the runs is\n\
+returned. These are numpy arrays if pyBigWig was installed with numpy\n\
+support, otherwise lists. Positions without values are in no run.\n\
+\n\
+>>> import pyBigWig\n\
+>>> bw = pyBigWig.open(\"test/test.bw\")\n\
+>>> bw.runs(\"1\", 0, 4)\n\
+(array([0, 1, 2], dtype=uint32), array([1, 1, 1], dtype=uint32),\n\
+ array([0.1, 0.2, 0.3], dtype=float32))\n\
 >>> bw.close()"},
     {"entries", (PyCFunction) pyBBGetEntries, METH_VARARGS|METH_KEYWORDS,
 "Retrieves entries from a bigBed file. These can optionally contain the string\n\
@@ -212,6 +212,176 @@ class TestLocal():
         blah.fname = os.path.dirname(pyBigWig.__file__) + "/pyBigWigTest/test.bw"
         blah.testAll()
 
+class TestMemory():
+    def testMemory(self):
+        for fname in ["test.bw", "test.bigBed"]:
+            fname = os.path.dirname(pyBigWig.__file__) + "/pyBigWigTest/" + fname
+            with open(fname, "rb") as f:
+                data = f.read()
+            expected = pyBigWig.open(fname)
+            for src in [data, bytearray(data), memoryview(data)]:
+                bw = pyBigWig.open(src)
+                assert(bw.isBigWig() == expected.isBigWig())
+                assert(bw.chroms() == expected.chroms())
+                assert(bw.header() == expected.header())
+                if bw.isBigWig():
+                    assert(bw.intervals("1") == expected.intervals("1"))
+                    assert(bw.stats("1", 0, 3, type="max", nBins=3) == expected.stats("1", 0, 3, type="max", nBins=3))
+                else:
+                    assert(bw.entries("chr1", 10000000, 10020000) == expected.entries("chr1", 10000000, 10020000))
+                bw.close()
+            expected.close()
+
+class TestRuns():
+    def testRuns(self):
+        ofile = tempfile.NamedTemporaryFile(delete=False)
+        oname = ofile.name
+        ofile.close()
+        bw = pyBigWig.open(oname, "w")
+        bw.addHeader([("1", 1000)])
+        bw.addEntries(["1", "1", "1", "1", "1"], [0, 10, 20, 40, 50], ends=[10, 20, 30, 50, 60], values=[1.0, 1.0, 2.0, 3.0, 3.0])
+        bw.close()
+        bw = pyBigWig.open(oname)
+        starts, lengths, values = bw.runs("1", 5, 55)
+        assert(list(starts) == [5, 20, 40])
+        assert(list(lengths) == [15, 10, 15])
+        assert(list(values) == [1.0, 2.0, 3.0])
+        starts, lengths, values = bw.runs("1", 100, 200)
+        assert(len(starts) == 0)
+        bw.close()
+        os.remove(oname)
+
+class TestBinnedStats():
+    def testBinnedStats(self):
+        ofile = tempfile.NamedTemporaryFile(delete=False)
+        oname = ofile.name
+        ofile.close()
+        bw = pyBigWig.open(oname, "w")
+        bw.addHeader([("1", 1000)])
+        bw.addEntries(["1", "1", "1"], [0, 10, 40], ends=[10, 20, 50], values=[1.0, 3.0, 2.0])
+        bw.close()
+        bw = pyBigWig.open(oname)
+        assert(bw.stats("1", 0, 50, binSize=20) == [2.0, None, 2.0])
+        assert(bw.stats("1", 0, 50, type="coverage", binSize=20) == [1.0, None, 1.0])
+        assert(bw.stats("1", 0, 50, type="sum", binSize=20) == [40.0, None, 20.0])
+        assert(bw.stats("1", 0, 40, type="max", binSize=20) == bw.stats("1", 0, 40, type="max", nBins=2, exact=True))
+        try:
+            bw.stats("1", 0, 40, nBins=2, binSize=20)
+            assert(1==0)
+        except RuntimeError:
+            pass
+        bw.close()
+        os.remove(oname)
+
+class TestManyChroms():
+    def writeChroms(self, n):
+        #More contigs than fit in one node of the chromosome tree, added in no particular order
+        order = np.random.RandomState(0).permutation(n)
+        chroms = [("contig%d" % i, 1000 + int(i)) for i in order]
+        ofile = tempfile.NamedTemporaryFile(delete=False)
+        oname = ofile.name
+        ofile.close()
+        bw = pyBigWig.open(oname, "w")
+        bw.addHeader(chroms)
+        bw.addEntries([chroms[0][0]], [10], ends=[20], values=[3.0])
+        bw.close()
+        return oname, dict(chroms)
+
+    def testChromTree(self):
+        oname, chroms = self.writeChroms(300)
+        bw = pyBigWig.open(oname)
+        assert(bw.chroms() == chroms)
+        for name, length in chroms.items():
+            assert(bw.chroms(name) == length)
+        assert(bw.chroms("contig") is None)
+        assert(bw.chroms("contig3000") is None)
+        bw.close()
+        os.remove(oname)
+
+    def testLazyChroms(self):
+        #Search the chromosome tree on disk rather than reading it, as happens for files with very many contigs
+        oname, chroms = self.writeChroms(3000)
+        pyBigWig.setLazyChromThreshold(1)
+        try:
+            bw = pyBigWig.open(oname)
+            assert(bw.intervals(next(iter(chroms))) == ((10, 20, 3.0),))
+            for name, length in chroms.items():
+                assert(bw.chroms(name) == length)
+            for name in ["contig", "contig29999", "contig0\t", "", "z" * 300]:
+                assert(bw.chroms(name) is None)
+            assert(bw.chroms() == chroms)
+            bw.close()
+        finally:
+            pyBigWig.setLazyChromThreshold(1000000)
+        os.remove(oname)
+
+class TestManyBlocks():
+    def writeBlocks(self):
+        #Enough entries, with gaps between some of them, for the data to span dozens of blocks
+        #Half way through there's a gap spanning no block at all, as does chromosome 2
+        rs = np.random.RandomState(0)
+        steps = rs.randint(1, 20, 100000)
+        steps[50000] = 1000000
+        ends = np.cumsum(steps)
+        starts = ends - np.minimum(steps, rs.randint(1, 10, 100000))
+        values = rs.uniform(-10, 10, 100000).astype(np.float32)
+        ofile = tempfile.NamedTemporaryFile(delete=False)
+        oname = ofile.name
+        ofile.close()
+        bw = pyBigWig.open(oname, "w")
+        bw.addHeader([("1", int(ends[-1]) + 1000), ("2", 1000), ("3", 1000)])
+        bw.addEntries(["1"] * len(starts), [int(x) for x in starts], ends=[int(x) for x in ends], values=[float(x) for x in values])
+        bw.addEntries(["3"] * 3, [0, 100, 500], ends=[50, 200, 1000], values=[1.0, 2.0, 3.0])
+        bw.close()
+        return oname, int(ends[-1])
+
+    def query(self, bw, last):
+        res = [bw.intervals("1"), bw.intervals("1", 12345, last - 54321), bw.intervals("2")]
+        res.append(bw.values("1", 0, last + 500, numpy=True))
+        res.append(bw.values("1", 7, last // 2, numpy=True))
+        for t in ["mean", "min", "max", "coverage", "std", "sum"]:
+            res.append(bw.stats("1", type=t, exact=True))
+            res.append(bw.stats("1", 1000, last - 1000, type=t, nBins=37, exact=True))
+        return res
+
+    def testThreads(self):
+        oname, last = self.writeBlocks()
+        bw = pyBigWig.open(oname)
+        expected = self.query(bw, last)
+        assert(len(expected[0]) == 100000)
+        pyBigWig.setThreads(4)
+        try:
+            res = self.query(bw, last)
+        finally:
+            pyBigWig.setThreads(1)
+        bw.close()
+        for r, e in zip(res, expected):
+            np.testing.assert_array_equal(r, e)
+        os.remove(oname)
+
+    def testFlattenIndex(self):
+        oname, last = self.writeBlocks()
+        bw = pyBigWig.open(oname)
+        flat = pyBigWig.open(oname)
+        flat.flattenIndex()
+        gap = bw.intervals("1")[49999][1]
+        #Ranges starting part way through blocks, as well as ones overlapping no block at all
+        rs = np.random.RandomState(1)
+        ranges = [("1", 0, last), ("1", gap, gap + 999000), ("1", gap + 10, gap + 20), ("1", last, last + 1000), ("2", 0, 1000), ("3", 0, 1000), ("3", 50, 100)]
+        for start in rs.randint(0, last, 200):
+            ranges.append(("1", int(start), int(start) + int(rs.randint(1, 50000))))
+        for chrom, start, end in ranges:
+            end = min(end, bw.chroms(chrom))
+            assert(flat.intervals(chrom, start, end) == bw.intervals(chrom, start, end))
+            np.testing.assert_array_equal(flat.values(chrom, start, end, numpy=True), bw.values(chrom, start, end, numpy=True))
+            assert(flat.stats(chrom, start, end, type="sum", nBins=3, exact=True) == bw.stats(chrom, start, end, type="sum", nBins=3, exact=True))
+        assert(flat.intervals("1", gap + 10, gap + 20) is None)
+        assert(flat.intervals("2") is None)
+        assert(flat.intervals("3") == ((0, 50, 1.0), (100, 200, 2.0), (500, 1000, 3.0)))
+        bw.close()
+        flat.close()
+        os.remove(oname)
+
 class TestBigBed():
     def testBigBed(self):
         fname = os.path.dirname(pyBigWig.__file__) + "/pyBigWigTest/test.bigBed"
@@ -1,16 +1,20 @@
 #!/usr/bin/env python
 from setuptools import setup, Extension
 from distutils import sysconfig
+from distutils.ccompiler import new_compiler
+from distutils.sysconfig import customize_compiler
 from pathlib import Path
 import subprocess
+import tempfile
 import glob
 import sys
+import os
 
 srcs = [x for x in 
     glob.glob("libBigWig/*.c")]
 srcs.append("pyBigWig.c")
 
-libs=["m", "z"]
+libs=["m", "z", "pthread"]
 
 # do not link to python on mac, see https://github.com/deeptools/pyBigWig/issues/58
 if 'dynamic_lookup' not in (sysconfig.get_config_var('LDSHARED') or ''):
@@ -42,6 +46,35 @@ for v in foo:
 
 include_dirs = ['libBigWig', sysconfig.get_config_var("INCLUDEPY")]
 
+# Decompress blocks with libdeflate if it's installed, since it's much faster than zlib
+def hasLibdeflate():
+    # The test program is compiled in a temporary directory, and a failure is the expected outcome without libdeflate, so the compiler is silenced
+    cc = new_compiler()
+    customize_compiler(cc)
+    cwd = os.getcwd()
+    savedFds = [os.dup(1), os.dup(2)]
+    devnull = os.open(os.devnull, os.O_WRONLY)
+    try:
+        with tempfile.TemporaryDirectory() as tmpdir:
+            os.chdir(tmpdir)
+            os.dup2(devnull, 1)
+            os.dup2(devnull, 2)
+            try:
+                return cc.has_function('libdeflate_alloc_decompressor', includes=['libdeflate.h'], libraries=['deflate'])
+            finally:
+                os.dup2(savedFds[0], 1)
+                os.dup2(savedFds[1], 2)
+                os.chdir(cwd)
+    except Exception:
+        return False
+    finally:
+        for fd in savedFds + [devnull]:
+            os.close(fd)
+
+if hasLibdeflate():
+    libs.append("deflate")
+    defines.append(('WITHLIBDEFLATE', None))
+
 # Add numpy build information if numpy is installed as a package
 try:
     import numpy